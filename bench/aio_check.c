@@ -0,0 +1,176 @@
+// Async check: backs a volume with host/zr_aio.c and several workers, so
+// completions come back on other threads and out of order, then streams
+// every file of an image at a few chunk hints and reads each one again as
+// many zr_file_read_async() pieces in flight at once, comparing the data
+// with the mapped image. Exits with 1 on any mismatch.
+//
+//   aio_check [-j workers] image
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "../zromfs.h"
+#include "../host/zr_aio.h"
+#include "tree.h"
+
+#define PIECE 1000              // odd sized, pieces straddle worker reads
+
+static const zr_u32_t hints[] = {0, 100, PIECE, ZR_STREAM_CHUNK};
+
+static struct {
+    const zr_u8_t* img;
+    zr_fs_t fs, mapped;
+    zr_aio_t aio;
+    tree_t tree;
+} g;
+
+typedef struct {
+    const zr_u8_t* ref;
+    zr_u32_t len, pos;
+} __sink_t;
+
+typedef struct {
+    int done, bad;              // touched by the workers
+} __batch_t;
+
+static int sink(void* ctx, const void* buf, zr_u32_t size)
+{
+    __sink_t* s = ctx;
+
+    if(s->pos + size > s->len || memcmp(buf, s->ref + s->pos, size) != 0)
+        return ZR_DISK_ERR;
+    s->pos += size;
+    return 0;
+}
+
+static void piece_done(void* ctx, int result)
+{
+    __batch_t* b = ctx;
+
+    if(result < 0)
+        __atomic_add_fetch(&b->bad, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&b->done, 1, __ATOMIC_RELEASE);
+}
+
+// the mapped bytes of path, NULL for files with none (compressed)
+static const zr_u8_t* ref(const char* path, zr_u32_t* len)
+{
+    zr_file_t f;
+    const void* p = NULL;
+
+    *len = 0xffffffff;
+    if(zr_file_open(&g.mapped, &f, path) != ZR_OK
+        || zr_file_read_ptr(&f, &p, len) != ZR_OK)
+        p = NULL;
+    zr_file_close(&f);
+    return p;
+}
+
+static int check_stream(const char* path, const zr_u8_t* p, zr_u32_t len,
+    zr_u32_t hint)
+{
+    zr_file_t f;
+    __sink_t s = {p, len, 0};
+    int ret;
+
+    if(zr_file_open(&g.fs, &f, path) != ZR_OK) {
+        printf("%s: open failed\n", path);
+        return 1;
+    }
+    ret = zr_file_stream(&f, 0xffffffff, sink, &s, hint);
+    zr_file_close(&f);
+    if(ret < 0 || s.pos != len) {
+        printf("%s, stream hint %u: %d, %u of %u bytes\n", path,
+            (unsigned)hint, ret, (unsigned)s.pos, (unsigned)len);
+        return 1;
+    }
+    return 0;
+}
+
+static int check_async(const char* path, const zr_u8_t* p, zr_u32_t len)
+{
+    zr_file_t f;
+    __batch_t b = {0, 0};
+    zr_u8_t* buf = malloc(len + PIECE);
+    int n, queued = 0;
+    zr_u32_t pos = 0;
+
+    if(zr_file_open(&g.fs, &f, path) != ZR_OK) {
+        printf("%s: open failed\n", path);
+        free(buf);
+        return 1;
+    }
+    while((n = zr_file_read_async(&f, buf + pos, PIECE, piece_done, &b))
+        >= 0) {
+        queued++;    // the 0 byte read at the end completes as well
+        if(n == 0)
+            break;
+        pos += n;
+    }
+    while(__atomic_load_n(&b.done, __ATOMIC_ACQUIRE) != queued)
+        g.fs.poll_f(&g.fs, 1);
+    zr_file_close(&f);
+    n = n < 0 || b.bad != 0 || pos != len || memcmp(buf, p, len) != 0;
+    if(n)
+        printf("%s, %d async pieces: %u of %u bytes, bad data or errors\n",
+            path, queued - 1, (unsigned)pos, (unsigned)len);
+    free(buf);
+    return n;
+}
+
+int main(int argc, char* argv[])
+{
+    struct stat st;
+    int fd, i, j, opt, workers = 4, bad = 0, skipped = 0;
+    int nhints = sizeof(hints) / sizeof(hints[0]);
+
+    while((opt = getopt(argc, argv, "j:")) != -1) {
+        if(opt != 'j')
+            break;
+        workers = atoi(optarg);
+    }
+    if(optind != argc - 1 || workers < 2 || workers > ZR_AIO_MAX_THREADS) {
+        fprintf(stderr, "Usage: %s [-j 2..%d] image\n", argv[0],
+            ZR_AIO_MAX_THREADS);
+        return 1;
+    }
+    fd = open(argv[optind], O_RDONLY);
+    if(fd < 0 || fstat(fd, &st) != 0) {
+        perror(argv[optind]);
+        return 1;
+    }
+    g.img = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(g.img == MAP_FAILED || zr_aio_init(&g.aio, fd, workers) != 0) {
+        perror(argv[optind]);
+        return 1;
+    }
+    g.mapped.base = g.img;
+    zr_aio_attach(&g.aio, &g.fs);
+    if(zr_fs_mount(&g.mapped) != ZR_OK || zr_fs_mount(&g.fs) != ZR_OK) {
+        fprintf(stderr, "%s: mount failed\n", argv[optind]);
+        return 1;
+    }
+    tree_collect(&g.fs, "", &g.tree);
+
+    for(i = 0; i < g.tree.nfiles; i++) {
+        zr_u32_t len;
+        const zr_u8_t* p = ref(g.tree.files[i], &len);
+
+        if(p == NULL) {
+            skipped++;
+            continue;
+        }
+        for(j = 0; j < nhints; j++)
+            bad += check_stream(g.tree.files[i], p, len, hints[j]);
+        bad += check_async(g.tree.files[i], p, len);
+    }
+    zr_aio_deinit(&g.aio);
+    close(fd);
+    printf("%d files (%d compressed skipped), %d workers, %d failed\n",
+        g.tree.nfiles - skipped, skipped, workers, bad);
+    return bad != 0;
+}
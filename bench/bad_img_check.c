@@ -0,0 +1,139 @@
+// Hostile image check: builds a 1 KiB image in memory whose headers point
+// past its end, a file declaring 1 MiB, a compressed block running off the
+// image and a compressed file whose block table does, and checks that
+// opening and reading them fails with ZR_DISK_ERR, both through read_f and
+// mapped, without touching a byte outside the image. A well-formed file
+// next to them must still read back. Exits with 1 on any failure.
+//
+//   bad_img_check
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../zromfs.h"
+
+#if ZR_LZ4_BLOCK_SIZE < 4096
+#error "build with -DZR_LZ4_BLOCK_SIZE=4096 or more"
+#endif
+
+#define IMG_SIZE 1024
+
+static struct {
+    zr_u8_t* img;               // exactly IMG_SIZE bytes, so ASan sees overruns
+    int outside, bad;
+} g;
+
+static void read_f(zr_u32_t offset, void* buf, zr_u32_t size)
+{
+    if(offset > IMG_SIZE || IMG_SIZE - offset < size) {
+        g.outside++;
+        memset(buf, 0, size);
+        return;
+    }
+    memcpy(buf, g.img + offset, size);
+}
+
+static void put_be(zr_u32_t offset, zr_u32_t v)
+{
+    g.img[offset] = v >> 24;
+    g.img[offset + 1] = v >> 16;
+    g.img[offset + 2] = v >> 8;
+    g.img[offset + 3] = v;
+}
+
+static zr_u32_t get_be(zr_u32_t offset)
+{
+    return (zr_u32_t)g.img[offset] << 24 | g.img[offset + 1] << 16
+        | g.img[offset + 2] << 8 | g.img[offset + 3];
+}
+
+// header with a name of up to 15 chars, returns the data offset
+static zr_u32_t hdr(zr_u32_t offset, zr_u32_t next, int type, zr_u32_t spec,
+    zr_u32_t size, const char* name)
+{
+    put_be(offset, next | type);
+    put_be(offset + 4, spec);
+    put_be(offset + 8, size);
+    strcpy((char*)g.img + offset + 16, name);
+    return offset + 32;
+}
+
+// "ZRLZ" header of a compressed file and its first table entries
+static void lz_hdr(zr_u32_t data, zr_u32_t usize, const zr_u32_t* tab,
+    int n)
+{
+    int i;
+
+    memcpy(g.img + data, "ZRLZ", 4);
+    put_be(data + 4, usize);
+    put_be(data + 8, 12UL << 24);
+    put_be(data + 12, (usize + 4095) >> 12);
+    for(i = 0; i < n; i++)
+        put_be(data + 16 + i * 4, tab[i]);
+}
+
+static void build(void)
+{
+    static const zr_u32_t lz[] = {28, 28 + 3000, 28 + 3000};
+    static const zr_u32_t lzt[] = {1044, 1044};
+    zr_u32_t i, sum = 0;
+
+    memset(g.img, 0, IMG_SIZE);
+    memcpy(g.img, "-rom1fs-", 8);
+    put_be(8, IMG_SIZE);
+    strcpy((char*)g.img + 16, "hostile");
+    hdr(32, 64, ZR_FTYPE_DIR, 32, 0, ".");
+    hdr(64, 96, ZR_FTYPE_DIR, 32, 0, "..");
+    memcpy(g.img + hdr(96, 144, ZR_FTYPE_REGULAR, 0, 5, "ok"), "hello", 5);
+    hdr(144, 192, ZR_FTYPE_REGULAR, 0, 0x100000, "big");
+    // one 3000 byte block of an 8 KiB file, from 28 bytes into the data
+    lz_hdr(hdr(192, 256, ZR_FTYPE_REGULAR, 8192, 28, "lz"), 8192, lz, 3);
+    // 1 MiB in 256 blocks, the table alone would run past the image
+    lz_hdr(hdr(256, 0, ZR_FTYPE_REGULAR, 0x100000, 1044, "lzt"), 0x100000,
+        lzt, 2);
+    for(i = 0; i < 512; i += 4)
+        sum += get_be(i);
+    put_be(12, -sum);
+}
+
+static void expect(const char* what, int got, int want)
+{
+    if((want < 0 && got >= 0) || (want >= 0 && got != want)) {
+        printf("%s: got %d, want %s%d\n", what, got, want < 0 ? "<" : "",
+            want < 0 ? 0 : want);
+        g.bad++;
+    }
+}
+
+static void check(zr_fs_t* fs)
+{
+    zr_file_t f;
+    char buf[64];
+
+    expect("mount", zr_fs_mount(fs), ZR_OK);
+    expect("open ok", zr_file_open(fs, &f, "/ok"), ZR_OK);
+    expect("read ok", zr_file_read(&f, buf, sizeof(buf)), 5);
+    expect("open big", zr_file_open(fs, &f, "/big"), ZR_DISK_ERR);
+    expect("open lz", zr_file_open(fs, &f, "/lz"), ZR_OK);
+    expect("read lz", zr_file_read(&f, buf, sizeof(buf)), -1);
+    expect("open lzt", zr_file_open(fs, &f, "/lzt"), ZR_OK);
+    zr_file_lseek(&f, 0x100000 - 16, 0);
+    expect("read lzt", zr_file_read(&f, buf, sizeof(buf)), -1);
+}
+
+int main(void)
+{
+    zr_fs_t fs;
+
+    g.img = malloc(IMG_SIZE);
+    build();
+    memset(&fs, 0, sizeof(fs));
+    fs.read_f = read_f;
+    check(&fs);
+    expect("reads outside the image", g.outside, 0);
+    memset(&fs, 0, sizeof(fs));
+    fs.base = g.img;
+    check(&fs);
+    printf("%d failed\n", g.bad);
+    return g.bad != 0;
+}
@@ -0,0 +1,174 @@
+// The host read providers of host/zr_host.c against the demo's lseek + read
+// callback, with and without the block cache: stat of every file, a walk
+// of every directory, a full read of every file, and the same again with
+// zr_file_read_async(), 32 chunks in flight, then zr_file_stream() into a
+// CRC-32 sink, which overlaps the next chunk with the sink on io_uring.
+// Prints CSV provider,cache,op,count,seconds,syscalls,syscalls_per_op.
+//
+//   host_bench image
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include "../zromfs.h"
+#include "../zr_crc32.h"
+#include "../host/zr_host.h"
+#include "tree.h"
+
+static struct {
+    tree_t tree;
+    int fd;                     // for the lseek + read baseline
+    zr_u32_t syscalls;
+} g;
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// what demo_cli/main.c does
+static void lseek_read(zr_u32_t offset, void* buf, zr_u32_t size)
+{
+    lseek(g.fd, offset, SEEK_SET);
+    if(read(g.fd, buf, size) != size)
+        memset(buf, 0, size);
+    g.syscalls += 2;
+}
+
+static void on_done(void* ctx, int result)
+{
+    *(zr_u32_t*)ctx += result;
+}
+
+static int crc_sink(void* ctx, const void* buf, zr_u32_t size)
+{
+    *(zr_u32_t*)ctx = zr_crc32(*(zr_u32_t*)ctx, buf, size);
+    return 0;
+}
+
+static void report(const char* name, int cache, const char* op, int count,
+    double t0, zr_u32_t calls)
+{
+    printf("%s,%d,%s,%d,%.6f,%lu,%.2f\n", name, cache, op, count,
+        now() - t0, (unsigned long)calls,
+        count ? (double)calls / count : 0.0);
+}
+
+static void run(const char* name, zr_fs_t* fs, zr_u32_t* syscalls, int cache,
+    zr_host_t* h)
+{
+    static zr_u8_t cache_buf[ZR_CACHE_BYTES(16)];
+    static char buf[4096], ring[32][4096];
+    zr_file_t fp;
+    zr_dir_t dir;
+    zr_finfo_t finfo;
+    zr_u32_t s0, got = 0;
+    double t0;
+    int i, n;
+
+    fs->cache_buf = cache ? cache_buf : NULL;
+    fs->cache_size = cache ? sizeof(cache_buf) : 0;
+    s0 = *syscalls;
+    t0 = now();
+    zr_fs_mount(fs);
+    report(name, cache, "mount", 1, t0, *syscalls - s0);
+
+    s0 = *syscalls;
+    t0 = now();
+    for(i = 0; i < g.tree.nfiles; i++)
+        zr_fs_stat(fs, g.tree.files[i], &finfo);
+    report(name, cache, "stat", g.tree.nfiles, t0, *syscalls - s0);
+
+    s0 = *syscalls;
+    t0 = now();
+    for(i = 0; i < g.tree.ndirs; i++) {
+        zr_fs_opendir(fs, &dir, g.tree.dirs[i]);
+        while(zr_readdir(&dir, &finfo) == ZR_OK)
+            ;
+    }
+    report(name, cache, "readdir", g.tree.ndirs, t0, *syscalls - s0);
+
+    s0 = *syscalls;
+    t0 = now();
+    for(i = 0; i < g.tree.nfiles; i++) {
+        zr_file_open(fs, &fp, g.tree.files[i]);
+        while(zr_file_read(&fp, buf, sizeof(buf)) > 0)
+            ;
+        zr_file_close(&fp);
+    }
+    report(name, cache, "read", g.tree.nfiles, t0, *syscalls - s0);
+
+    s0 = *syscalls;
+    t0 = now();
+    for(i = 0; i < g.tree.nfiles; i++) {
+        zr_file_open(fs, &fp, g.tree.files[i]);
+        n = 0;
+        do {
+            if(n % 32 == 0 && h != NULL)    // ring[] slots are about to be reused
+                zr_host_poll(h, 1);
+        } while(zr_file_read_async(&fp, ring[n++ % 32], 4096, on_done, &got) > 0);
+        if(h != NULL)
+            zr_host_poll(h, 1);
+        zr_file_close(&fp);
+    }
+    report(name, cache, "async", g.tree.nfiles, t0, *syscalls - s0);
+
+    s0 = *syscalls;
+    t0 = now();
+    for(i = 0; i < g.tree.nfiles; i++) {
+        zr_file_open(fs, &fp, g.tree.files[i]);
+        zr_file_stream(&fp, 0xffffffff, crc_sink, &got, 0);
+        zr_file_close(&fp);
+    }
+    report(name, cache, "stream", g.tree.nfiles, t0, *syscalls - s0);
+}
+
+int main(int argc, char* argv[])
+{
+    static const char* names[] = {"pread", "mmap", "io_uring"};
+    static zr_fs_t fs;
+    zr_host_t h;
+    int kind, cache;
+
+    if(argc != 2) {
+        fprintf(stderr, "Usage: %s image\n", argv[0]);
+        return 1;
+    }
+    if(zr_host_open(&h, argv[1], ZR_HOST_MMAP) < 0) {
+        perror(argv[1]);
+        return 1;
+    }
+    zr_host_attach(&h, &fs);
+    if(zr_fs_mount(&fs) != ZR_OK) {
+        fprintf(stderr, "%s: mount failed\n", argv[1]);
+        return 1;
+    }
+    tree_collect(&fs, "", &g.tree);
+    zr_host_close(&h);
+
+    printf("provider,cache,op,count,seconds,syscalls,syscalls_per_op\n");
+    for(cache = 0; cache <= 1; cache++) {
+        memset(&fs, 0, sizeof(fs));
+        g.fd = open(argv[1], O_RDONLY);
+        fs.read_f = lseek_read;
+        run("lseek_read", &fs, &g.syscalls, cache, NULL);
+        close(g.fd);
+
+        for(kind = ZR_HOST_PREAD; kind <= ZR_HOST_URING; kind++) {
+            memset(&fs, 0, sizeof(fs));
+            if(zr_host_open(&h, argv[1], kind) != kind) {
+                fprintf(stderr, "%s not available\n", names[kind]);
+                continue;
+            }
+            zr_host_attach(&h, &fs);
+            run(names[kind], &fs, &h.syscalls, cache, &h);
+            zr_host_close(&h);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,183 @@
+// Read throughput of the C++ front end against a hand-written loop over
+// the mapped image, the C API, and the callback and cached policies, for a
+// range of read sizes. Every file of the image is read start to end.
+// Prints CSV api,chunk,mb_per_s,ns_per_read.
+//
+//   hpp_bench image
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../zromfs.hpp"
+
+#define MAX_FILES 1024
+
+static struct {
+    unsigned char* img;
+    long len;
+    char paths[MAX_FILES][64];
+    int nfiles;
+} g;
+
+volatile unsigned long sink;    // keeps the reads from being optimised away
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void read_f(zr_u32_t offset, void* buf, zr_u32_t size)
+{
+    memcpy(buf, g.img + offset, size);
+}
+
+using mapped_vol = zr::volume<zr::mapped>;
+using callback_vol = zr::volume<zr::callback<read_f>>;
+using cached_vol = zr::volume<zr::cached<zr::callback<read_f>, 16>>;
+
+template<class Vol>
+static void collect(Vol& vol, const char* path)
+{
+    for(const zr::entry& e : vol.opendir(path)) {
+        char sub[64];
+        zr::entry t = e;
+        if(e.name() == "." || e.name() == ".." || e.fname[15] != '\0')
+            continue;
+        snprintf(sub, sizeof(sub), "%s/%s", path, e.fname);
+        if(e.ftype == ZR_FTYPE_HARDLINK && vol.stat(sub, t) != ZR_OK)
+            continue;    // packed images list files as hardlinks
+        if(t.is_dir())
+            collect(vol, sub);
+        else if(t.is_file() && g.nfiles < MAX_FILES)
+            strcpy(g.paths[g.nfiles++], sub);
+    }
+}
+
+static void report(const char* api, zr_u32_t chunk, double bytes,
+    double reads, double dt)
+{
+    printf("%s,%lu,%.1f,%.2f\n", api, (unsigned long)chunk, bytes / dt / 1e6,
+        dt / reads * 1e9);
+}
+
+// how many passes over all files make about 64 MiB
+static int passes(zr_u32_t total)
+{
+    return total ? (64u << 20) / total + 1 : 1;
+}
+
+template<class Vol>
+static void run(Vol& vol, const char* api, zr_u32_t chunk, int use_c)
+{
+    static decltype(vol.open("")) files[MAX_FILES];
+    unsigned char* buf = (unsigned char*)malloc(chunk);
+    double bytes = 0, reads = 0, t0;
+    zr_u32_t total = 0;
+    int i, p, n, np;
+
+    for(i = 0; i < g.nfiles; i++) {
+        files[i] = vol.open(g.paths[i]);
+        total += files[i].size();
+    }
+    np = passes(total);
+    t0 = now();
+    for(p = 0; p < np; p++) {
+        for(i = 0; i < g.nfiles; i++) {
+            files[i].seek(0);
+            if(use_c)
+                while((n = zr_file_read(files[i].native(), buf, chunk)) > 0) {
+                    bytes += n;
+                    reads++;
+                    sink += buf[0];
+                }
+            else
+                while((n = files[i].read(buf, chunk)) > 0) {
+                    bytes += n;
+                    reads++;
+                    sink += buf[0];
+                }
+        }
+    }
+    report(api, chunk, bytes, reads, now() - t0);
+    for(i = 0; i < g.nfiles; i++)
+        files[i].close();
+    free(buf);
+}
+
+// the baseline: pointer and size of every file known, plain memcpy
+static void run_pointer(mapped_vol& vol, zr_u32_t chunk)
+{
+    static const unsigned char* ptr[MAX_FILES];
+    static zr_u32_t size[MAX_FILES];
+    unsigned char* buf = (unsigned char*)malloc(chunk);
+    double bytes = 0, reads = 0, t0;
+    zr_u32_t total = 0, off, n;
+    int i, p, np;
+
+    for(i = 0; i < g.nfiles; i++) {
+        std::string_view v = vol.open(g.paths[i]).view();
+        ptr[i] = (const unsigned char*)v.data();
+        size[i] = v.size();
+        total += size[i];
+    }
+    np = passes(total);
+    t0 = now();
+    for(p = 0; p < np; p++) {
+        for(i = 0; i < g.nfiles; i++) {
+            for(off = 0; off < size[i]; off += n) {
+                n = size[i] - off < chunk ? size[i] - off : chunk;
+                memcpy(buf, ptr[i] + off, n);
+                bytes += n;
+                reads++;
+                sink += buf[0];
+            }
+        }
+    }
+    report("pointer", chunk, bytes, reads, now() - t0);
+    free(buf);
+}
+
+int main(int argc, char* argv[])
+{
+    static const zr_u32_t chunks[] = {16, 64, 512, 4096};
+    static mapped_vol* mvol;
+    static callback_vol cvol;
+    static cached_vol kvol;
+    FILE* f;
+    zr_u32_t i;
+
+    if(argc < 2 || (f = fopen(argv[1], "rb")) == NULL) {
+        fprintf(stderr, "Usage: %s image\n", argv[0]);
+        return 1;
+    }
+    fseek(f, 0, SEEK_END);
+    g.len = ftell(f);
+    rewind(f);
+    g.img = (unsigned char*)malloc(g.len);
+    if(fread(g.img, 1, g.len, f) != (size_t)g.len) {
+        fprintf(stderr, "can't read %s\n", argv[1]);
+        return 1;
+    }
+    fclose(f);
+
+    mvol = new mapped_vol(zr::mapped{g.img});
+    if(mvol->mount() != ZR_OK || cvol.mount() != ZR_OK
+        || kvol.mount() != ZR_OK) {
+        fprintf(stderr, "mount failed\n");
+        return 1;
+    }
+    collect(*mvol, "");
+
+    printf("api,chunk,mb_per_s,ns_per_read\n");
+    for(i = 0; i < sizeof(chunks) / sizeof(chunks[0]); i++) {
+        run_pointer(*mvol, chunks[i]);
+        run(*mvol, "hpp_mapped", chunks[i], 0);
+        run(*mvol, "c_mapped", chunks[i], 1);
+        run(cvol, "hpp_callback", chunks[i], 0);
+        run(kvol, "hpp_cached", chunks[i], 0);
+    }
+    return 0;
+}
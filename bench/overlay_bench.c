@@ -0,0 +1,124 @@
+// Overlay lookups through a small patch image on top of a base image, with
+// and without Bloom filters: zr_overlay_stat and zr_overlay_open of every
+// path of the base image, almost all of them missing from the patch.
+// Prints CSV bloom,op,count,seconds,patch_reads,base_reads,patch_reads_per_op.
+//
+//   overlay_bench base.img patch.img
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../zromfs.h"
+#include "tree.h"
+
+static struct {
+    zr_u8_t* img[2];            // patch, base
+    long len[2];
+    tree_t tree[2];
+    char** paths;               // the base's directories, then its files
+    int npaths;
+} g;
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void read_patch(zr_u32_t offset, void* buf, zr_u32_t size)
+{
+    memcpy(buf, g.img[0] + offset, size);
+}
+
+static void read_base(zr_u32_t offset, void* buf, zr_u32_t size)
+{
+    memcpy(buf, g.img[1] + offset, size);
+}
+
+static zr_u8_t* load(const char* name, long* len)
+{
+    FILE* f = fopen(name, "rb");
+    zr_u8_t* p;
+
+    if(f == NULL)
+        return NULL;
+    fseek(f, 0, SEEK_END);
+    *len = ftell(f);
+    rewind(f);
+    p = malloc(*len);
+    if(fread(p, 1, *len, f) != (size_t)*len) {
+        free(p);
+        p = NULL;
+    }
+    fclose(f);
+    return p;
+}
+
+static void report(int bloom, const char* op, double t0, zr_stats_t st[2])
+{
+    printf("%d,%s,%d,%.6f,%lu,%lu,%.3f\n", bloom, op, g.npaths, now() - t0,
+        (unsigned long)st[0].calls, (unsigned long)st[1].calls,
+        (double)st[0].calls / g.npaths);
+    memset(&st[0], 0, sizeof(st[0]));
+    memset(&st[1], 0, sizeof(st[1]));
+}
+
+int main(int argc, char* argv[])
+{
+    static zr_fs_t fs[2];
+    static zr_stats_t st[2];
+    zr_fs_t* const layers[2] = {&fs[0], &fs[1]};
+    zr_overlay_t ov = {layers, 2};
+    zr_finfo_t finfo;
+    zr_file_t fp;
+    zr_u32_t bloom_size[2];
+    double t0;
+    int i, bloom;
+
+    if(argc != 3 || (g.img[1] = load(argv[1], &g.len[1])) == NULL
+        || (g.img[0] = load(argv[2], &g.len[0])) == NULL) {
+        fprintf(stderr, "Usage: %s base.img patch.img\n", argv[0]);
+        return 1;
+    }
+    fs[0].read_f = read_patch;
+    fs[1].read_f = read_base;
+    for(i = 0; i < 2; i++) {
+        if(zr_fs_mount(&fs[i]) != ZR_OK) {
+            fprintf(stderr, "%s: mount failed\n", argv[2 - i]);
+            return 1;
+        }
+        tree_collect(&fs[i], "", &g.tree[i]);
+        bloom_size[i] = ZR_BLOOM_BYTES(g.tree[i].ndirs + g.tree[i].nfiles);
+    }
+    g.paths = malloc((g.tree[1].ndirs + g.tree[1].nfiles) * sizeof(char*));
+    for(i = 0; i < g.tree[1].ndirs; i++)
+        g.paths[g.npaths++] = g.tree[1].dirs[i];
+    for(i = 0; i < g.tree[1].nfiles; i++)
+        g.paths[g.npaths++] = g.tree[1].files[i];
+
+    printf("bloom,op,count,seconds,patch_reads,base_reads,patch_reads_per_op\n");
+    for(bloom = 0; bloom <= 1; bloom++) {
+        t0 = now();
+        for(i = 0; i < 2; i++) {
+            fs[i].bloom_buf = bloom ? malloc(bloom_size[i]) : NULL;
+            fs[i].bloom_size = bloom ? bloom_size[i] : 0;
+            fs[i].stats = &st[i];
+            zr_fs_mount(&fs[i]);
+        }
+        report(bloom, "mount", t0, st);
+
+        t0 = now();
+        for(i = 0; i < g.npaths; i++)
+            zr_overlay_stat(&ov, g.paths[i], &finfo);
+        report(bloom, "stat", t0, st);
+
+        t0 = now();
+        for(i = 0; i < g.npaths; i++)
+            if(zr_overlay_open(&ov, &fp, g.paths[i]) == ZR_OK)
+                zr_file_close(&fp);
+        report(bloom, "open", t0, st);
+    }
+    return 0;
+}
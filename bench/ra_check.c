@@ -0,0 +1,136 @@
+// Read-ahead check: reads every file of an image sequentially in chunk
+// sizes that start the window at odd sizes, compares the data with the
+// mapped image and checks that the window never grows past ra_buf. A guard
+// after the zr_file_t catches writes past the end of it. Exits with 1 on
+// any mismatch.
+//
+//   ra_check image
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "../zromfs.h"
+#include "tree.h"
+
+#if ZR_READAHEAD_SIZE == 0
+#error "build with -DZR_READAHEAD_SIZE=n"
+#endif
+
+#define GUARD (ZR_READAHEAD_SIZE * 2)    // a window doubled from below the buffer size stays under twice it
+
+// above a quarter of the buffer the window starts at the first read size
+static const zr_u32_t chunks[] = {1, 3, 33, 65, 100, 129, 200,
+    ZR_READAHEAD_SIZE - 1, ZR_READAHEAD_SIZE + 1};
+
+static struct {
+    const zr_u8_t* img;
+    zr_fs_t fs, mapped;
+    tree_t tree;
+} g;
+
+static struct {
+    zr_file_t f;
+    zr_u8_t guard[GUARD];
+} file;
+
+#if ZR_REENTRANT
+void zr_lock(zr_fs_t* fs)    // one thread, nothing to guard
+{
+}
+
+void zr_unlock(zr_fs_t* fs)
+{
+}
+#endif
+
+static void read_f(zr_u32_t offset, void* buf, zr_u32_t size)
+{
+    memcpy(buf, g.img + offset, size);
+}
+
+// one file in one chunk size, 1 if anything is wrong
+static int check(const char* path, zr_u32_t chunk)
+{
+    static zr_u8_t buf[ZR_READAHEAD_SIZE * 2];
+    zr_file_t ref;
+    const void* p;
+    zr_u32_t len = 0xffffffff, pos = 0;
+    int i, n;
+
+    zr_file_open(&g.mapped, &ref, path);
+    zr_file_read_ptr(&ref, &p, &len);
+    zr_file_close(&ref);
+
+    memset(file.guard, 0xA5, GUARD);
+    if(zr_file_open(&g.fs, &file.f, path) != ZR_OK) {
+        printf("%s: open failed\n", path);
+        return 1;
+    }
+    while((n = zr_file_read(&file.f, buf, chunk)) > 0) {
+        if(file.f.ra_win > ZR_READAHEAD_SIZE) {
+            printf("%s, %u byte reads: window %u at %u\n", path,
+                (unsigned)chunk, (unsigned)file.f.ra_win, (unsigned)pos);
+            return 1;
+        }
+        if(pos + n > len || memcmp(buf, (const zr_u8_t*)p + pos, n) != 0) {
+            printf("%s, %u byte reads: bad data at %u\n", path,
+                (unsigned)chunk, (unsigned)pos);
+            return 1;
+        }
+        pos += n;
+    }
+    zr_file_close(&file.f);
+    for(i = 0; i < GUARD; i++) {
+        if(file.guard[i] != 0xA5) {
+            printf("%s, %u byte reads: wrote past zr_file_t\n", path,
+                (unsigned)chunk);
+            return 1;
+        }
+    }
+    if(n < 0 || pos != len) {
+        printf("%s, %u byte reads: %u of %u bytes\n", path, (unsigned)chunk,
+            (unsigned)pos, (unsigned)len);
+        return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char* argv[])
+{
+    struct stat st;
+    int fd, i, j, bad = 0;
+    int nchunks = sizeof(chunks) / sizeof(chunks[0]);
+
+    if(argc != 2) {
+        fprintf(stderr, "Usage: %s image\n", argv[0]);
+        return 1;
+    }
+    fd = open(argv[1], O_RDONLY);
+    if(fd < 0 || fstat(fd, &st) != 0) {
+        perror(argv[1]);
+        return 1;
+    }
+    g.img = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(g.img == MAP_FAILED) {
+        perror(argv[1]);
+        return 1;
+    }
+    g.mapped.base = g.img;
+    g.fs.read_f = read_f;
+    if(zr_fs_mount(&g.mapped) != ZR_OK || zr_fs_mount(&g.fs) != ZR_OK) {
+        fprintf(stderr, "%s: mount failed\n", argv[1]);
+        return 1;
+    }
+    tree_collect(&g.fs, "", &g.tree);
+
+    for(i = 0; i < g.tree.nfiles; i++)
+        for(j = 0; j < nchunks; j++)
+            bad += check(g.tree.files[i], chunks[j]);
+    printf("%d files, %d chunk sizes, %d failed\n", g.tree.nfiles, nchunks, bad);
+    return bad != 0;
+}
@@ -0,0 +1,163 @@
+// The usual operations on an image served by the emulated SPI NOR of
+// host/zr_spinor.c, in every read mode: mount, stat of every file, a walk
+// of every directory, full reads of every file in 4096 and in 64 byte
+// chunks. Each one reports the host time next to the projected bus time.
+// Prints CSV mode,mhz,op,count,host_s,reads,bytes,crossings,device_s,
+// device_us_per_op.
+//
+//   spinor_bench [-f mhz] [-t setup_ns] [-x boundary,cross_ns] [-c sectors]
+//                [-A align[,burst]] image
+//
+// -t is the fixed cost of every read command (chip select, driver, DMA),
+// -x a stall for reads crossing a boundary, -c and -A set up the block
+// cache and aligned reads.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "../zromfs.h"
+#include "../host/zr_spinor.h"
+#include "tree.h"
+
+static struct {
+    tree_t tree;
+    int mode;
+    double mhz;
+} g = {.mhz = 80};
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void report(zr_spinor_t* s, const char* op, int count, double t0)
+{
+    printf("%s,%g,%s,%d,%.6f,%lu,%lu,%lu,%.6f,%.2f\n",
+        zr_spinor_names[g.mode], g.mhz, op, count, now() - t0,
+        (unsigned long)s->reads, (unsigned long)s->bytes,
+        (unsigned long)s->crossings, s->ns * 1e-9,
+        count ? s->ns * 1e-3 / count : 0.0);
+    zr_spinor_reset(s);
+}
+
+static void read_all(zr_fs_t* fs, zr_u32_t chunk)
+{
+    static char buf[4096];
+    zr_file_t fp;
+    int i;
+
+    for(i = 0; i < g.tree.nfiles; i++) {
+        zr_file_open(fs, &fp, g.tree.files[i]);
+        while(zr_file_read(&fp, buf, chunk) > 0)
+            ;
+        zr_file_close(&fp);
+    }
+}
+
+static void run(zr_fs_t* fs, zr_spinor_t* s)
+{
+    zr_dir_t dir;
+    zr_finfo_t finfo;
+    double t0;
+    int i;
+
+    zr_spinor_reset(s);
+    t0 = now();
+    zr_fs_mount(fs);
+    report(s, "mount", 1, t0);
+
+    t0 = now();
+    for(i = 0; i < g.tree.nfiles; i++)
+        zr_fs_stat(fs, g.tree.files[i], &finfo);
+    report(s, "stat", g.tree.nfiles, t0);
+
+    t0 = now();
+    for(i = 0; i < g.tree.ndirs; i++) {
+        zr_fs_opendir(fs, &dir, g.tree.dirs[i]);
+        while(zr_readdir(&dir, &finfo) == ZR_OK)
+            ;
+    }
+    report(s, "readdir", g.tree.ndirs, t0);
+
+    t0 = now();
+    read_all(fs, 4096);
+    report(s, "read", g.tree.nfiles, t0);
+
+    t0 = now();
+    read_all(fs, 64);
+    report(s, "read_64", g.tree.nfiles, t0);
+}
+
+int main(int argc, char* argv[])
+{
+    static zr_fs_t fs;
+    zr_spinor_t s;
+    zr_u32_t setup = 0, boundary = 0, cross = 0, sectors = 0, size;
+    zr_u32_t align = 0, burst = 0;
+    zr_u8_t* img;
+    FILE* fp;
+    long n;
+    int opt;
+
+    while((opt = getopt(argc, argv, "f:t:x:c:A:")) != -1) {
+        switch(opt) {
+            case 'f': g.mhz = atof(optarg); break;
+            case 't': setup = strtoul(optarg, NULL, 0); break;
+            case 'x': sscanf(optarg, "%u,%u", &boundary, &cross); break;
+            case 'c': sectors = atoi(optarg); break;
+            case 'A': sscanf(optarg, "%u,%u", &align, &burst); break;
+            default: argc = 0;
+        }
+    }
+    if(optind != argc - 1 || g.mhz <= 0) {
+        fprintf(stderr, "Usage: %s [-f mhz] [-t setup_ns] "
+            "[-x boundary,cross_ns] [-c sectors] [-A align[,burst]] image\n",
+            argv[0]);
+        return 1;
+    }
+    if((fp = fopen(argv[optind], "rb")) == NULL) {
+        perror(argv[optind]);
+        return 1;
+    }
+    fseek(fp, 0, SEEK_END);
+    n = ftell(fp);
+    rewind(fp);
+    img = malloc(n ? n : 1);
+    if(fread(img, 1, n, fp) != n) {
+        perror(argv[optind]);
+        return 1;
+    }
+    fclose(fp);
+    size = n;
+
+    fs.base = img;
+    if(zr_fs_mount(&fs) != ZR_OK) {
+        fprintf(stderr, "%s: mount failed\n", argv[optind]);
+        return 1;
+    }
+    tree_collect(&fs, "", &g.tree);
+
+    printf("mode,mhz,op,count,host_s,reads,bytes,crossings,device_s,"
+        "device_us_per_op\n");
+    for(g.mode = 0; g.mode < ZR_SPINOR_MODES; g.mode++) {
+        memset(&fs, 0, sizeof(fs));
+        zr_spinor_init(&s, img, size, g.mode, g.mhz * 1e6);
+        s.setup_ns = setup;
+        s.boundary = boundary;
+        s.cross_ns = cross;
+        zr_spinor_attach(&s, &fs);
+        fs.cache_size = sectors ? ZR_CACHE_BYTES(sectors) : 0;
+        fs.cache_buf = sectors ? malloc(fs.cache_size) : NULL;
+        fs.io_align = align;
+        fs.io_burst = burst;
+        fs.io_bounce = align ? malloc(align) : NULL;
+        run(&fs, &s);
+        free(fs.cache_buf);
+        free(fs.io_bounce);
+    }
+    return 0;
+}
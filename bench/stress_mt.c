@@ -0,0 +1,156 @@
+// Multi-threaded stress benchmark for the reentrant API: every worker opens,
+// stats and reads all files of one shared volume through its own zr_file_t.
+// Prints throughput for 1..N threads so scaling can be checked.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include "../zromfs.h"
+#include "tree.h"
+
+#define MAX_THREADS 64
+
+static struct {
+    int img;
+    zr_fs_t fs;
+    tree_t tree;
+    double seconds;
+    int stop;                   // shared with the workers, __atomic_* only
+    pthread_mutex_t table_lock, cache_lock;
+} g = {.seconds = 1.0, .table_lock = PTHREAD_MUTEX_INITIALIZER,
+    .cache_lock = PTHREAD_MUTEX_INITIALIZER};
+
+void zr_lock(zr_fs_t* fs)
+{
+    pthread_mutex_lock(fs ? &g.cache_lock : &g.table_lock);
+}
+
+void zr_unlock(zr_fs_t* fs)
+{
+    pthread_mutex_unlock(fs ? &g.cache_lock : &g.table_lock);
+}
+
+static void read_fv(zr_fs_t* fs, const zr_iovec_t* iov, int iovcnt)
+{
+    int i;
+    for(i = 0; i < iovcnt; i++)
+        if(pread(g.img, iov[i].buf, iov[i].size, iov[i].offset) < 0)
+            break;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void* worker(void* arg)
+{
+    unsigned long ops = 0;
+    char buf[4096];
+    int i = (int)(long)arg;
+
+    while(!__atomic_load_n(&g.stop, __ATOMIC_RELAXED)) {
+        zr_file_t f;
+        zr_finfo_t finfo;
+        const char* path = g.tree.files[i++ % g.tree.nfiles];
+
+        if(zr_fs_stat(&g.fs, path, &finfo) != ZR_OK
+            || zr_file_open(&g.fs, &f, path) != ZR_OK) {
+            fprintf(stderr, "lookup of %s failed\n", path);
+            exit(1);
+        }
+        while(zr_file_read(&f, buf, sizeof(buf)) > 0)
+            ;
+        zr_file_close(&f);
+        ops++;
+    }
+    return (void*)ops;
+}
+
+int main(int argc, char* argv[])
+{
+    static zr_u32_t cache[ZR_CACHE_BYTES(64) / 4];
+    static zr_u32_t index[ZR_INDEX_BYTES(8192) / 4];
+    pthread_t threads[MAX_THREADS];
+    int opt, max_threads = 8, n;
+    double base = 0;
+
+    while((opt = getopt(argc, argv, "t:s:mci")) != -1) {
+        switch(opt) {
+            case 't':
+                max_threads = atoi(optarg);
+                break;
+            case 's':
+                g.seconds = atof(optarg);
+                break;
+            case 'm':
+                g.fs.base = (void*)1;    // mapped below
+                break;
+            case 'c':
+                g.fs.cache_buf = cache;
+                g.fs.cache_size = sizeof(cache);
+                break;
+            case 'i':
+                g.fs.index_buf = index;
+                g.fs.index_size = sizeof(index);
+                break;
+        }
+    }
+    if(optind >= argc || max_threads < 1 || max_threads > MAX_THREADS) {
+        puts("Usage: stress_mt [-t threads] [-s seconds] [-m] [-c] [-i] img_file");
+        return 1;
+    }
+    g.img = open(argv[optind], O_RDONLY);
+    if(g.img < 0) {
+        perror(argv[optind]);
+        return 1;
+    }
+    if(g.fs.base != NULL) {
+        struct stat st;
+        fstat(g.img, &st);
+        g.fs.base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, g.img, 0);
+    }
+    else
+        g.fs.read_fv = read_fv;
+    if(zr_fs_mount(&g.fs) != ZR_OK) {
+        puts("mount failed");
+        return 1;
+    }
+    tree_collect(&g.fs, "", &g.tree);
+    if(g.tree.nfiles == 0) {
+        puts("no files");
+        return 1;
+    }
+
+    printf("threads,ops,seconds,ops_per_s,speedup\n");
+    for(n = 1; n <= max_threads; n *= 2) {
+        unsigned long ops = 0;
+        double t0 = now(), dt;
+        int i;
+
+        __atomic_store_n(&g.stop, 0, __ATOMIC_RELAXED);
+        for(i = 0; i < n; i++)
+            pthread_create(&threads[i], NULL, worker, (void*)(long)(i * 7));
+        usleep(g.seconds * 1e6);
+        __atomic_store_n(&g.stop, 1, __ATOMIC_RELAXED);
+        for(i = 0; i < n; i++) {
+            void* r;
+            pthread_join(threads[i], &r);
+            ops += (unsigned long)r;
+        }
+        dt = now() - t0;
+        if(n == 1)
+            base = ops / dt;
+        printf("%d,%lu,%.3f,%.0f,%.2f\n", n, ops, dt, ops / dt,
+            ops / dt / base);
+    }
+    return 0;
+}
@@ -0,0 +1,49 @@
+#include "tree.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void __add(char*** list, int* n, int* cap, const char* path)
+{
+    if(*n == *cap) {
+        *cap = *cap ? *cap * 2 : 256;
+        *list = realloc(*list, *cap * sizeof(char*));
+    }
+    (*list)[(*n)++] = strdup(path);
+}
+
+static void __walk(zr_fs_t* fs, const char* path, tree_t* t, int depth)
+{
+    zr_dir_t dir;
+    zr_finfo_t items[32];
+    char names[4096], sub[1024];
+    const char* name;
+    int i, n;
+
+    if(depth > ZR_MAX_DEPTH || zr_fs_opendir(fs, &dir, path) != ZR_OK)
+        return;
+    __add(&t->dirs, &t->ndirs, &t->dirs_cap, path);
+    while((n = zr_readdir_batch(&dir, items, 32, names, sizeof(names),
+        ZR_READDIR_SKIP_DOTS)) > 0) {
+        for(i = 0, name = names; i < n; name += strlen(name) + 1, i++) {
+            zr_finfo_t* finfo = &items[i];
+
+            if(snprintf(sub, sizeof(sub), "%s/%s", path, name)
+                >= sizeof(sub))
+                continue;
+            if(finfo->ftype == ZR_FTYPE_HARDLINK    // files of packed images
+                && zr_fs_stat(fs, sub, finfo) != ZR_OK)
+                continue;
+            if(finfo->ftype == ZR_FTYPE_DIR)
+                __walk(fs, sub, t, depth + 1);
+            else if(finfo->ftype == ZR_FTYPE_REGULAR)
+                __add(&t->files, &t->nfiles, &t->files_cap, sub);
+        }
+    }
+}
+
+void tree_collect(zr_fs_t* fs, const char* path, tree_t* t)
+{
+    __walk(fs, path, t, 0);
+}
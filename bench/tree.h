@@ -0,0 +1,19 @@
+#ifndef __BENCH_TREE_H
+#define __BENCH_TREE_H
+
+// Paths of the directories and regular files of a mounted image, shared by
+// the benchmarks and checks. Names come whole from zr_readdir_batch(), the
+// hardlinks of packed images count as what they point at.
+
+#include "../zromfs.h"
+
+typedef struct {
+    char** files;               // strdup()ed, grown as needed
+    char** dirs;                // path itself first
+    int nfiles, ndirs;
+    int files_cap, dirs_cap;
+} tree_t;                       // all zero to start
+
+void tree_collect(zr_fs_t* fs, const char* path, tree_t* t);    // add path and everything below it
+
+#endif
@@ -0,0 +1,491 @@
+// Benchmark for mount, open, stat, readdir and read on synthetic romfs
+// images. The image is generated in memory from a shape preset, or loaded
+// from a file, and served through a counting read_f so every result comes
+// with the number of backend calls and bytes next to the wall time.
+//
+//   zr_bench [-S wide|deep|small|huge] [-n files] [-f fsize] [-d depth]
+//            [-w fanout] [-b chunk] [-m] [-c sectors] [-i] [-j]
+//            [-s lat_us,mb_per_s[,page,slow_mb_per_s]] [-A align[,burst]]
+//            [-o out.img] [img_file]
+//
+// Output is CSV, or JSON with -j, one record per operation. -s adds a
+// flash cost model: every backend call costs lat_us and every byte moves
+// at mb_per_s, on top of the measured CPU time. model_mb_per_s is the file
+// data zr_read delivered per modelled second, so compressed and plain
+// images compare on what the application gets. With page and slow_mb_per_s
+// transfers that aren't whole pages into word aligned buffers move at the
+// slow rate. -A sets io_align and io_burst, with a bounce buffer.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include "../zromfs.h"
+#include "tree.h"
+
+typedef struct {
+    const char* name;
+    int depth, fanout, files;
+    zr_u32_t fsize;
+} shape_t;
+
+static const shape_t shapes[] = {
+    {"wide", 0, 0, 2000, 64},        // one directory, many entries
+    {"deep", 24, 1, 4, 256},         // long directory chain
+    {"small", 2, 8, 32, 100},        // 73 directories of small files
+    {"huge", 0, 0, 4, 8 << 20},      // a few big files
+};
+
+typedef struct {
+    const char* op;
+    int count;
+    double seconds;
+    double* lat;
+    zr_u32_t calls, bytes, slow_bytes;
+    double delivered;           // bytes returned by zr_read
+} result_t;
+
+static struct {
+    zr_u8_t* img;
+    zr_u32_t len, cap;
+    zr_u32_t* hdrs;
+    int nhdrs, hcap;
+    zr_u32_t calls, bytes, slow_bytes;
+    tree_t tree;
+    double spi_lat, spi_bw;     // cost model, seconds per call and bytes per second
+    zr_u32_t page;              // and transfers of partial pages
+    double slow_bw;
+} g;
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void read_f(zr_u32_t offset, void* buf, zr_u32_t size)
+{
+    g.calls++;
+    g.bytes += size;
+    if(g.page != 0 && (offset % g.page != 0 || size % g.page != 0
+        || (uintptr_t)buf % 4 != 0))
+        g.slow_bytes += size;
+    memcpy(buf, g.img + offset, size);
+}
+
+// image generator, same layout as genromfs
+
+static void put_be(zr_u32_t offset, zr_u32_t v)
+{
+    g.img[offset] = v >> 24;
+    g.img[offset + 1] = v >> 16;
+    g.img[offset + 2] = v >> 8;
+    g.img[offset + 3] = v;
+}
+
+static zr_u32_t get_be(zr_u32_t offset)
+{
+    return (zr_u32_t)g.img[offset] << 24 | g.img[offset + 1] << 16
+        | g.img[offset + 2] << 8 | g.img[offset + 3];
+}
+
+static void reserve(zr_u32_t n)
+{
+    while(g.len + n > g.cap) {
+        g.cap = g.cap ? g.cap * 2 : 1 << 20;
+        g.img = realloc(g.img, g.cap);
+    }
+    memset(g.img + g.len, 0, n);
+}
+
+static zr_u32_t put_entry(const char* name, int type, zr_u32_t spec,
+    zr_u32_t size, zr_u32_t seed)
+{
+    zr_u32_t h = g.len, namelen = (strlen(name) + 16) & ~15, i;
+
+    reserve(16 + namelen + ((size + 15) & ~15));
+    put_be(h, type | (type == ZR_FTYPE_DIR ? 8 : 0));
+    put_be(h + 4, spec);
+    put_be(h + 8, size);
+    memcpy(g.img + h + 16, name, strlen(name));
+    g.len += 16 + namelen;
+    for(i = 0; i < size; i++)
+        g.img[g.len + i] = (seed + i) * 2654435761u >> 24;
+    g.len += (size + 15) & ~15;
+
+    if(g.nhdrs == g.hcap) {
+        g.hcap = g.hcap ? g.hcap * 2 : 1024;
+        g.hdrs = realloc(g.hdrs, g.hcap * sizeof(*g.hdrs));
+    }
+    g.hdrs[g.nhdrs++] = h;
+    return h;
+}
+
+static void link_next(zr_u32_t prev, zr_u32_t next)
+{
+    put_be(prev, next | (get_be(prev) & 0xf));
+}
+
+// writes ".", "..", the files and then the subdirectories of one directory
+static void gen_dir(const shape_t* s, int level, zr_u32_t self,
+    zr_u32_t parent)
+{
+    char name[16];
+    zr_u32_t prev, h;
+    int i;
+
+    if(level == 0)    // the root "." is the directory itself
+        prev = put_entry(".", ZR_FTYPE_DIR, g.len, 0, 0);
+    else
+        prev = put_entry(".", ZR_FTYPE_HARDLINK, self, 0, 0);
+    if(level == 0)
+        self = parent = prev;
+    h = put_entry("..", ZR_FTYPE_HARDLINK, parent, 0, 0);
+    link_next(prev, h);
+    prev = h;
+
+    for(i = 0; i < s->files; i++) {
+        sprintf(name, "f%04d.bin", i);
+        h = put_entry(name, ZR_FTYPE_REGULAR, 0, s->fsize, g.nhdrs);
+        link_next(prev, h);
+        prev = h;
+    }
+    if(level >= s->depth)
+        return;
+    for(i = 0; i < (s->fanout ? s->fanout : 1); i++) {
+        sprintf(name, "d%02d", i);
+        h = put_entry(name, ZR_FTYPE_DIR, 0, 0, 0);
+        put_be(h + 4, g.len);
+        link_next(prev, h);
+        prev = h;
+        gen_dir(s, level + 1, h, self);
+    }
+}
+
+static void fix_checksum(zr_u32_t offset, zr_u32_t len)
+{
+    zr_u32_t i, sum = 0;
+    for(i = 0; i < len; i += 4)
+        sum += get_be(offset + i);
+    put_be(offset + 12, get_be(offset + 12) - sum);
+}
+
+static void generate(const shape_t* s)
+{
+    int i;
+
+    g.len = 0;
+    reserve(32);
+    memcpy(g.img, "-rom1fs-", 8);
+    memcpy(g.img + 16, s->name, strlen(s->name));
+    g.len = 32;
+    gen_dir(s, 0, 0, 0);
+    for(i = 0; i < g.nhdrs; i++) {
+        zr_u32_t h = g.hdrs[i];
+        fix_checksum(h, 16 + ((strlen((char*)g.img + h + 16) + 16) & ~15));
+    }
+    reserve(1024);
+    g.len = (g.len + 1023) & ~1023;
+    put_be(8, g.len);
+    fix_checksum(0, g.len < 512 ? g.len : 512);
+}
+
+static int load(const char* fname)
+{
+    FILE* f = fopen(fname, "rb");
+    long n;
+
+    if(f == NULL)
+        return -1;
+    fseek(f, 0, SEEK_END);
+    n = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    g.cap = g.len = n;
+    g.img = malloc(n);
+    n = fread(g.img, 1, n, f);
+    fclose(f);
+    return n == g.len ? 0 : -1;
+}
+
+// benchmarks, one latency sample per operation
+
+static int cmp_double(const void* a, const void* b)
+{
+    double x = *(const double*)a, y = *(const double*)b;
+    return x < y ? -1 : x > y;
+}
+
+static void begin(result_t* r, const char* op, int count)
+{
+    r->op = op;
+    r->count = count;
+    r->lat = malloc((count ? count : 1) * sizeof(double));
+    r->delivered = 0;
+    g.calls = g.bytes = g.slow_bytes = 0;
+}
+
+static void end(result_t* r, double t0)
+{
+    r->seconds = now() - t0;
+    r->calls = g.calls;
+    r->bytes = g.bytes;
+    r->slow_bytes = g.slow_bytes;
+    qsort(r->lat, r->count, sizeof(double), cmp_double);
+}
+
+static void bench_mount(result_t* r, zr_fs_t* fs)
+{
+    int i, n = 200;
+    double t0 = now(), t;
+
+    begin(r, "mount", n);
+    for(i = 0; i < n; i++) {
+        t = now();
+        zr_fs_mount(fs);
+        r->lat[i] = now() - t;
+    }
+    end(r, t0);
+}
+
+static void bench_open(result_t* r)
+{
+    int i, fd;
+    double t0 = now(), t;
+
+    begin(r, "open", g.tree.nfiles);
+    for(i = 0; i < g.tree.nfiles; i++) {
+        t = now();
+        fd = zr_open(g.tree.files[i]);
+        zr_close(fd);
+        r->lat[i] = now() - t;
+    }
+    end(r, t0);
+}
+
+static void bench_stat(result_t* r)
+{
+    zr_finfo_t finfo;
+    int i;
+    double t0 = now(), t;
+
+    begin(r, "stat", g.tree.nfiles);
+    for(i = 0; i < g.tree.nfiles; i++) {
+        t = now();
+        zr_stat(g.tree.files[i], &finfo);
+        r->lat[i] = now() - t;
+    }
+    end(r, t0);
+}
+
+static void bench_readdir(result_t* r)
+{
+    zr_dir_t dir;
+    zr_finfo_t finfo;
+    int i;
+    double t0 = now(), t;
+
+    begin(r, "readdir", g.tree.ndirs);
+    for(i = 0; i < g.tree.ndirs; i++) {
+        t = now();
+        zr_opendir(&dir, g.tree.dirs[i]);
+        while(zr_readdir(&dir, &finfo) == ZR_OK)
+            ;
+        r->lat[i] = now() - t;
+    }
+    end(r, t0);
+}
+
+static void bench_readdir_batch(result_t* r)
+{
+    static zr_finfo_t items[64];
+    static char names[4096];
+    zr_dir_t dir;
+    int i;
+    double t0 = now(), t;
+
+    begin(r, "readdir_batch", g.tree.ndirs);
+    for(i = 0; i < g.tree.ndirs; i++) {
+        t = now();
+        zr_opendir(&dir, g.tree.dirs[i]);
+        while(zr_readdir_batch(&dir, items, 64, names, sizeof(names), 0) > 0)
+            ;
+        r->lat[i] = now() - t;
+    }
+    end(r, t0);
+}
+
+static void bench_read(result_t* r, int chunk)
+{
+    char* buf = malloc(chunk);
+    int i, fd, n;
+    double t0 = now(), t;
+
+    begin(r, "read", g.tree.nfiles);
+    for(i = 0; i < g.tree.nfiles; i++) {
+        t = now();
+        fd = zr_open(g.tree.files[i]);
+        while((n = zr_read(fd, buf, chunk)) > 0)
+            r->delivered += n;
+        zr_close(fd);
+        r->lat[i] = now() - t;
+    }
+    end(r, t0);
+    free(buf);
+}
+
+static void report(const result_t* r, int n, const char* image, int json)
+{
+    int i;
+
+    if(json)
+        printf("[\n");
+    else
+        printf("image,op,count,seconds,ops_per_s,mean_ns,p50_ns,p99_ns,"
+            "max_ns,read_calls,read_bytes,calls_per_op,bytes_per_op,"
+            "model_s,model_mb_per_s\n");
+    for(i = 0; i < n; i++, r++) {
+        int c = r->count ? r->count : 1;
+        double mean = r->seconds / c * 1e9, p50 = r->lat[c / 2] * 1e9;
+        double p99 = r->lat[c * 99 / 100] * 1e9, max = r->lat[c - 1] * 1e9;
+        double model = r->seconds + r->calls * g.spi_lat;
+        if(g.spi_bw > 0)
+            model += (r->bytes - r->slow_bytes) / g.spi_bw;
+        if(g.slow_bw > 0)
+            model += r->slow_bytes / g.slow_bw;
+        if(r->count == 0)
+            mean = p50 = p99 = max = 0;
+        if(json)
+            printf("  {\"image\": \"%s\", \"op\": \"%s\", \"count\": %d, "
+                "\"seconds\": %.6f, \"ops_per_s\": %.1f, \"mean_ns\": %.0f, "
+                "\"p50_ns\": %.0f, \"p99_ns\": %.0f, \"max_ns\": %.0f, "
+                "\"read_calls\": %lu, \"read_bytes\": %lu, "
+                "\"calls_per_op\": %.2f, \"bytes_per_op\": %.1f, "
+                "\"model_s\": %.6f, \"model_mb_per_s\": %.2f}%s\n",
+                image, r->op, r->count, r->seconds, r->count / r->seconds,
+                mean, p50, p99, max, (unsigned long)r->calls,
+                (unsigned long)r->bytes, (double)r->calls / c,
+                (double)r->bytes / c, model, r->delivered / model / 1e6,
+                i < n - 1 ? "," : "");
+        else
+            printf("%s,%s,%d,%.6f,%.1f,%.0f,%.0f,%.0f,%.0f,%lu,%lu,%.2f,%.1f,"
+                "%.6f,%.2f\n", image, r->op, r->count, r->seconds,
+                r->count / r->seconds, mean, p50, p99, max,
+                (unsigned long)r->calls, (unsigned long)r->bytes,
+                (double)r->calls / c, (double)r->bytes / c, model,
+                r->delivered / model / 1e6);
+    }
+    if(json)
+        printf("]\n");
+}
+
+int main(int argc, char* argv[])
+{
+    static zr_fs_t fs;
+    static result_t res[6];
+    shape_t s = shapes[0];
+    const char* out = NULL, * image;
+    int opt, i, chunk = 512, mapped = 0, sectors = 0, indexed = 0, json = 0;
+    zr_u32_t align = 0, burst = 0;
+
+    while((opt = getopt(argc, argv, "S:n:f:d:w:b:mc:ijs:A:o:")) != -1) {
+        switch(opt) {
+            case 'S':
+                for(i = 0; i < sizeof(shapes) / sizeof(shapes[0]); i++)
+                    if(strcmp(optarg, shapes[i].name) == 0)
+                        break;
+                if(i == sizeof(shapes) / sizeof(shapes[0])) {
+                    fprintf(stderr, "unknown shape %s\n", optarg);
+                    return 1;
+                }
+                s = shapes[i];
+                break;
+            case 'n': s.files = atoi(optarg); break;
+            case 'f': s.fsize = strtoul(optarg, NULL, 0); break;
+            case 'd': s.depth = atoi(optarg); break;
+            case 'w': s.fanout = atoi(optarg); break;
+            case 'b': chunk = atoi(optarg); break;
+            case 'm': mapped = 1; break;
+            case 'c': sectors = atoi(optarg); break;
+            case 'i': indexed = 1; break;
+            case 'j': json = 1; break;
+            case 's':
+                if(sscanf(optarg, "%lf,%lf,%u,%lf", &g.spi_lat, &g.spi_bw,
+                    &g.page, &g.slow_bw) < 2) {
+                    fprintf(stderr, "-s wants lat_us,mb_per_s"
+                        "[,page,slow_mb_per_s]\n");
+                    return 1;
+                }
+                g.spi_lat *= 1e-6;
+                g.spi_bw *= 1e6;
+                g.slow_bw *= 1e6;
+                break;
+            case 'A': sscanf(optarg, "%u,%u", &align, &burst); break;
+            case 'o': out = optarg; break;
+            default:
+                fprintf(stderr, "Usage: %s [-S wide|deep|small|huge] "
+                    "[-n files] [-f fsize] [-d depth] [-w fanout] [-b chunk] "
+                    "[-m] [-c sectors] [-i] [-j] "
+                    "[-s lat_us,mb_per_s[,page,slow_mb_per_s]] "
+                    "[-A align[,burst]] [-o out.img] [img_file]\n",
+                    argv[0]);
+                return 1;
+        }
+    }
+    if(chunk <= 0)
+        chunk = 512;
+
+    if(optind < argc) {
+        image = argv[optind];
+        if(load(image) != 0) {
+            fprintf(stderr, "can't read %s\n", image);
+            return 1;
+        }
+    }
+    else {
+        image = s.name;
+        generate(&s);
+    }
+    if(out != NULL) {
+        FILE* f = fopen(out, "wb");
+        if(f == NULL || fwrite(g.img, 1, g.len, f) != g.len) {
+            fprintf(stderr, "can't write %s\n", out);
+            return 1;
+        }
+        fclose(f);
+    }
+
+    fs.read_f = read_f;
+    if(mapped)
+        fs.base = g.img;
+    if(sectors > 0) {
+        fs.cache_size = ZR_CACHE_BYTES(sectors);
+        fs.cache_buf = malloc(fs.cache_size);
+    }
+    if(align > 1) {
+        fs.io_align = align;
+        fs.io_burst = burst;
+        fs.io_bounce = malloc(align);
+    }
+    if(zr_fs_mount(&fs) != ZR_OK) {    // a first mount to find the paths
+        fprintf(stderr, "mount failed\n");
+        return 1;
+    }
+    zr_select_volume(zr_mount(&fs));
+    tree_collect(&fs, "", &g.tree);
+    if(indexed) {    // room for every path at the 75% load limit
+        fs.index_size = ZR_INDEX_BYTES((g.tree.nfiles + g.tree.ndirs) * 4 / 3 + 1);
+        fs.index_buf = malloc(fs.index_size);
+        zr_fs_mount(&fs);
+    }
+
+    bench_mount(&res[0], &fs);
+    bench_open(&res[1]);
+    bench_stat(&res[2]);
+    bench_readdir(&res[3]);
+    bench_readdir_batch(&res[4]);
+    bench_read(&res[5], chunk);
+    report(res, 6, image, json);
+    return 0;
+}
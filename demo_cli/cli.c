@@ -3,28 +3,33 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include "../zromfs.h"
-#include "crc32.h"
+#include "../zr_crc32.h"
 #include <sys/stat.h>
 #include <errno.h>
 
 #define MSG_LEN 256
 #define GEN_BUF_SIZE 32
 #define ok() printf("ok\n");
+#ifdef _WIN32
+#define __mkdir(path) mkdir(path)
+#else
+#define __mkdir(path) mkdir(path, 0755)
+#endif
 
 static struct {
     char pwd[64];
     char gen_buf[GEN_BUF_SIZE];
 } g = {.pwd = "/", };
 
-extern zr_fs_t fs;
 const char* ftype[] = {"Hardlink", "Dir", "Regular", "Sym. Link", "Blk. Dev",
     "Char. Dev", "Socket", "Fifo"};
 
 static void cmd_ls(char* const tokens[])
 {
     zr_dir_t dir;
-    zr_finfo_t finfo;
-    int n = 0, ll = 0, tot_size = 0;
+    zr_finfo_t items[16];
+    char names[512], * name;
+    int i, cnt, n = 0, ll = 0, tot_size = 0;
     if(strcasecmp(tokens[0], "ll") == 0)
         ll = 1;
 
@@ -33,15 +38,19 @@ static void cmd_ls(char* const tokens[])
     if(ll)
         printf("%-8s %-8s %-8s %-8s %-10s %-16s\n", "Offset", "Spec", "Next",
             "Size", "Type", "Filename");
-    while(zr_readdir(&dir, &finfo) == ZR_OK) {
-        n++;
-        tot_size += finfo.fsize;
-        if(ll)
-            printf("%-8lX %-8lX %-8lX %-8lu %-10s %-16s\n", finfo.offset,
-                finfo.spec, finfo.next, finfo.fsize, ftype[finfo.ftype],
-                finfo.fname);
-        else
-            printf("%s\t", finfo.fname);
+    while((cnt = zr_readdir_batch(&dir, items, 16, names, sizeof(names),
+        0)) > 0) {
+        for(i = 0, name = names; i < cnt; i++, name += strlen(name) + 1) {
+            n++;
+            tot_size += items[i].fsize;
+            if(ll)
+                printf("%-8lX %-8lX %-8lX %-8lu %-10s %-16s\n",
+                    (unsigned long)items[i].offset, (unsigned long)items[i].spec,
+                    (unsigned long)items[i].next, (unsigned long)items[i].fsize,
+                    ftype[items[i].ftype], name);
+            else
+                printf("%s\t", name);
+        }
     }
     printf("\n");
     if(ll)
@@ -68,8 +77,10 @@ static void cmd_stat(char* const tokens[])
     }
     printf("%-8s %-8s %-8s %-8s %-10s %-16s\n", "Offset", "Spec", "Next",
         "Size", "Type", "Filename");
-    printf("%-8lX %-8lX %-8lX %-8lu %-10s %-16s\n\n", finfo.offset, finfo.spec,
-        finfo.next, finfo.fsize, ftype[finfo.ftype], finfo.fname);
+    printf("%-8lX %-8lX %-8lX %-8lu %-10s %-16s\n\n",
+        (unsigned long)finfo.offset, (unsigned long)finfo.spec,
+        (unsigned long)finfo.next, (unsigned long)finfo.fsize,
+        ftype[finfo.ftype], finfo.fname);
 }
 
 const char* str_help =
@@ -79,6 +90,10 @@ pwd:   show working directory.\n\
 cd:    change working directory.\n\
 cat:   show file content.\n\
 stat:  show file infomation.\n\
+export: copy a file, or a directory with -r, to the host.\n\
+stats: show flash reads since the last stats.\n\
+trace: save flash reads since the last trace to a host file.\n\
+fsck:  check the working directory and everything below it.\n\
 help:  show help.\n";
 
 static void cmd_help(char* const tokens[])
@@ -104,10 +119,17 @@ static int __open_file(const char* fname, int* size)
         printf("    Failed to open file %s.\n\n", fname);
         return -1;
     }
+    zr_fadvise(fd, ZR_ADV_SEQUENTIAL);    // all callers stream the whole file
     *size = finfo.fsize;
     return fd;
 }
 
+// zr_stream() sink writing to the FILE* in ctx
+static int __write_sink(void* ctx, const void* buf, zr_u32_t size)
+{
+    return fwrite(buf, 1, size, ctx) == size ? 0 : -1;
+}
+
 static void cmd_cat(char* const tokens[])
 {
     int size;
@@ -115,16 +137,8 @@ static void cmd_cat(char* const tokens[])
     if(fd < 0)
         return;
 
-    while(size > 0) {
-        int n = GEN_BUF_SIZE;
-        memset(g.gen_buf, 0, GEN_BUF_SIZE);
-        n = zr_read(fd, g.gen_buf, n);
-        if(n <= 0)
-            break;
-        fwrite(g.gen_buf, n, 1, stdout);
-        fflush(stdout);
-        size -= n;
-    }
+    zr_stream(fd, size, __write_sink, stdout, 0);
+    fflush(stdout);
     printf("\n\n");
     zr_close(fd);
 }
@@ -142,7 +156,7 @@ static void cmd_hexview(char* const tokens[])
     while(size > 0) {
         int n = 16;
         memset(g.gen_buf, 0, 16);
-        printf("%08lX ", zr_tell(fd));
+        printf("%08lX ", (unsigned long)zr_tell(fd));
         n = zr_read(fd, g.gen_buf, n);
 //        printf("n=%d\n", n);
         if(n <= 0)
@@ -159,23 +173,17 @@ static void cmd_hexview(char* const tokens[])
 
 static void cmd_crc32(char* const tokens[])
 {
-    int size;
-    int fd = __open_file(tokens[1], &size);
-    if(fd < 0)
-        return;
-    unsigned long crc = 0xffffffff;
+    zr_u32_t crc;
+    char path[256];
+    strcpy(path, g.pwd);
+    strcat(path, "/");
+    strcat(path, tokens[1]);
 
-    while(size > 0) {
-        int n = GEN_BUF_SIZE;
-        memset(g.gen_buf, 0, GEN_BUF_SIZE);
-        n = zr_read(fd, g.gen_buf, n);
-        if(n <= 0)
-            break;
-        crc = crc32(crc, g.gen_buf, n);
-        size -= n;
+    if(zr_file_crc32(path, &crc) != ZR_OK) {
+        printf("    File %s not found.\n\n", tokens[1]);
+        return;
     }
-    printf("%08lX\n\n", ~crc);
-    zr_close(fd);
+    printf("%08lX\n\n", (unsigned long)crc);
 }
 
 static void cmd_export(char* const tokens[])
@@ -197,21 +205,191 @@ static void cmd_export(char* const tokens[])
     }
     FILE* fp = fopen(tokens[1], "wb");
 
-    while(size > 0) {
-        int n = GEN_BUF_SIZE;
-        memset(g.gen_buf, 0, GEN_BUF_SIZE);
-        n = zr_read(fd, g.gen_buf, n);
-        if(n <= 0)
-            break;
-        fwrite(g.gen_buf, n, 1, fp);
-        size -= n;
-    }
+    zr_stream(fd, size, __write_sink, fp, 0);
     fclose(fp);
 
     printf("File %s exported.\n\n", tokens[1]);
     zr_close(fd);
 }
 
+// copy the file at path to the host file out
+static int __export_file(const char* path, const char* out)
+{
+    int n, fd = zr_open(path);
+    if(fd < 0)
+        return fd;
+    FILE* fp = fopen(out, "wb");
+    if(fp == NULL) {
+        zr_close(fd);
+        return -1;
+    }
+    n = zr_stream(fd, 0xffffffff, __write_sink, fp, 0);
+    fclose(fp);
+    zr_close(fd);
+    return n < 0 ? n : 0;
+}
+
+// copy the tree under path to the host directory out, returns files copied;
+// names that could leave out (empty, with a '/', or too long) are skipped
+static int __export_dir(const char* path, const char* out, int depth)
+{
+    zr_dir_t dir;
+    zr_finfo_t items[16];
+    char names[512], * name;
+    int i, cnt, n = 0;
+
+    if(depth > ZR_MAX_DEPTH || zr_opendir(&dir, path) != ZR_OK)
+        return 0;
+    if(__mkdir(out) != 0 && errno != EEXIST) {
+        printf("    Failed to create %s.\n", out);
+        return 0;
+    }
+    while((cnt = zr_readdir_batch(&dir, items, 16, names, sizeof(names),
+        ZR_READDIR_SKIP_DOTS)) > 0) {
+        for(i = 0, name = names; i < cnt; i++, name += strlen(name) + 1) {
+            zr_finfo_t* finfo = &items[i];
+            char sub[256], osub[256];
+
+            if(name[0] == '\0' || strchr(name, '/') != NULL
+                || snprintf(sub, sizeof(sub), "%s/%s", path, name)
+                >= sizeof(sub)
+                || snprintf(osub, sizeof(osub), "%s/%s", out, name)
+                >= sizeof(osub)) {
+                printf("    Skipped a bad name in %s.\n", path);
+                continue;
+            }
+            if(finfo->ftype == ZR_FTYPE_HARDLINK
+                && zr_stat(sub, finfo) != ZR_OK)
+                continue;    // packed images list files as hardlinks
+            if(finfo->ftype == ZR_FTYPE_DIR)
+                n += __export_dir(sub, osub, depth + 1);
+            else if(finfo->ftype == ZR_FTYPE_REGULAR) {
+                if(__export_file(sub, osub) == 0)
+                    n++;
+                else
+                    printf("    Failed to export %s.\n", sub);
+            }
+        }
+    }
+    return n;
+}
+
+static void cmd_export_r(char* const tokens[])
+{
+    struct stat st;
+    zr_finfo_t finfo;
+    char path[256];
+
+    if(strcmp(tokens[1], "-r") != 0) {
+        printf("Usage: export [-r] name\n\n");
+        return;
+    }
+    strcpy(path, g.pwd);
+    strcat(path, "/");
+    strcat(path, tokens[2]);
+    if(stat(tokens[2], &st) == 0) {
+        printf("File %s already exists.\n\n", tokens[2]);
+        return;
+    }
+    if(zr_stat(path, &finfo) != ZR_OK || finfo.ftype != ZR_FTYPE_DIR) {
+        printf("    Directory %s not found.\n\n", tokens[2]);
+        return;
+    }
+    printf("%d files exported to %s.\n\n", __export_dir(path, tokens[2], 0),
+        tokens[2]);
+}
+
+static void cmd_stats(char* const tokens[])
+{
+    static const char* origins[] = {"mount", "lookup", "readdir", "data",
+        "checksum"};
+    zr_stats_t* st = zr_get_stats(zr_get_volume());
+    int i;
+
+    if(st == NULL) {
+        printf("    No statistics for this volume.\n\n");
+        return;
+    }
+    printf("%lu reads, %lu bytes, %lu us, slowest %lu us\n",
+        (unsigned long)st->calls, (unsigned long)st->bytes,
+        (unsigned long)st->time, (unsigned long)st->time_max);
+    printf("%-10s %-8s %-10s %-8s\n", "Origin", "Reads", "Bytes", "us");
+    for(i = 0; i < ZR_IO_ORIGINS; i++)
+        printf("%-10s %-8lu %-10lu %-8lu\n", origins[i],
+            (unsigned long)st->origin_calls[i],
+            (unsigned long)st->origin_bytes[i],
+            (unsigned long)st->origin_time[i]);
+    printf("%-10s %-8s\n", "Size", "Reads");
+    for(i = 0; i < ZR_STATS_BUCKETS; i++)
+        if(st->hist[i] != 0)
+            printf("%-10lu %-8lu\n", 1UL << i, (unsigned long)st->hist[i]);
+    printf("\n");
+    zr_reset_stats(zr_get_volume());
+}
+
+static void cmd_fsck(char* const tokens[])
+{
+    static const char* errors[] = {"", "out of bounds", "bad checksum",
+        "cycle", "bad type"};
+    zr_fs_t* fs = zr_get_fs(zr_get_volume());
+    zr_fsck_t r = {0};
+    int ret;
+
+    if(fs == NULL) {
+        printf("    No volume selected.\n\n");
+        return;
+    }
+    r.map_size = ZR_FSCK_MAP_BYTES(fs->size);
+    r.map = malloc(r.map_size);
+    ret = zr_fsck(fs, g.pwd, ZR_FSCK_DATA, &r);
+    free(r.map);
+    if(ret == ZR_DIR_NOT_FOUND) {
+        printf("    %s not found.\n\n", g.pwd);
+        return;
+    }
+    printf("%lu headers, %lu dirs, %lu files, %lu bytes, data sum %08lX\n",
+        (unsigned long)r.headers, (unsigned long)r.dirs,
+        (unsigned long)r.files, (unsigned long)r.bytes,
+        (unsigned long)r.data_sum);
+    if(ret == ZR_OK)
+        printf("No errors.\n\n");
+    else
+        printf("%lu errors, first: %s at %08lX.\n\n", (unsigned long)r.errors,
+            errors[r.error], (unsigned long)r.bad);
+}
+
+// save the requests since mount or the last trace, for tools/zr_trace
+static void cmd_trace(char* const tokens[])
+{
+    zr_trace_t* tr = zr_get_trace(zr_get_volume());
+    zr_trace_rec_t recs[64];
+    zr_u8_t out[8];
+    zr_u32_t i, n, total = 0;
+    int k;
+
+    if(tr == NULL) {
+        printf("    No trace for this volume.\n\n");
+        return;
+    }
+    FILE* fp = fopen(tokens[1], "wb");
+    if(fp == NULL) {
+        printf("Can't create %s.\n\n", tokens[1]);
+        return;
+    }
+    while((n = zr_trace_copy(tr, recs, 64)) > 0) {
+        for(i = 0; i < n; i++) {    // little-endian whatever the host
+            for(k = 0; k < 4; k++) {
+                out[k] = recs[i].offset >> (k * 8);
+                out[4 + k] = recs[i].info >> (k * 8);
+            }
+            fwrite(out, 8, 1, fp);
+        }
+        total += n;
+    }
+    fclose(fp);
+    printf("%lu requests saved to %s.\n\n", (unsigned long)total, tokens[1]);
+}
+
 static void cmd_cd(char* const tokens[])
 {
     zr_dir_t dir;
@@ -257,6 +435,10 @@ const struct {
     {cmd_hexview, "hexview", 2},    //
     {cmd_crc32, "crc32", 2},    //
     {cmd_export, "export", 2},    //
+    {cmd_export_r, "export", 3},    //
+    {cmd_stats, "stats", 1},    //
+    {cmd_trace, "trace", 2},    //
+    {cmd_fsck, "fsck", 1},    //
     {cmd_help, "help", 1},    //
     {cmd_help, "?", 1},    //
     };
@@ -267,17 +449,20 @@ static void Parse(char* const tokens[], int count)
         ok();
     }
 
+    for(int i = 0; i < sizeof(cmds) / sizeof(cmds[0]); i++) {
+        if(strcasecmp(tokens[0], cmds[i].name) == 0
+            && count == cmds[i].n_args) {
+            cmds[i].func(tokens);
+            return;
+        }
+    }
     for(int i = 0; i < sizeof(cmds) / sizeof(cmds[0]); i++) {
         if(strcasecmp(tokens[0], cmds[i].name) == 0) {
-            if(count == cmds[i].n_args)
-                cmds[i].func(tokens);
-            else {
-                printf("Usage: %s ", cmds[i].name);
-                for(int j = 1; j < cmds[i].n_args; j++) {
-                    printf("arg%d ", j);
-                }
-                printf("\n");
+            printf("Usage: %s ", cmds[i].name);
+            for(int j = 1; j < cmds[i].n_args; j++) {
+                printf("arg%d ", j);
             }
+            printf("\n");
         }
     }
 }
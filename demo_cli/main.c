@@ -2,22 +2,43 @@
 #include <stdlib.h>
 #include <fcntl.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
 #include "../zromfs.h"
 #include "cli.h"
 
+#ifndef _O_BINARY
+#define _O_BINARY 0    // only Windows tells text from binary
+#endif
+
 static struct {
     int fd;
 } g;
 
 void read_func(zr_u32_t offset, void* buf, zr_u32_t size)
 {
+#ifdef _WIN32
     lseek(g.fd, offset, SEEK_SET);
     read(g.fd, buf, size);
+#else
+    if(pread(g.fd, buf, size, offset) != size)    // one syscall, not two
+        memset(buf, 0, size);
+#endif
+}
+
+static zr_u32_t clock_us(void)
+{
+    return (zr_u32_t)(clock() * (1000000.0 / CLOCKS_PER_SEC));
 }
 
 int main(int argc, char* argv[])
 {
     static zr_fs_t fs;
+    static zr_stats_t stats = {.clock = clock_us};
+    static zr_u32_t cache[ZR_CACHE_BYTES(16) / 4];
+    static zr_u32_t index[ZR_INDEX_BYTES(64) / 4];
+    static zr_trace_rec_t recs[4096];
+    static zr_trace_t trace = {.recs = recs, .n = 4096};
     if(argc != 2) {
         puts("Usage: zr_cli img_file");
         exit(1);
@@ -26,6 +47,12 @@ int main(int argc, char* argv[])
 
     fs.start = 0;
     fs.read_f = read_func;
+    fs.cache_buf = cache;
+    fs.cache_size = sizeof(cache);
+    fs.index_buf = index;
+    fs.index_size = sizeof(index);
+    fs.stats = &stats;
+    fs.trace = &trace;
 
     int ret = zr_mount(&fs);
     printf("%d\n", ret);
@@ -0,0 +1,144 @@
+#include "zr_aio.h"
+
+#include <string.h>
+#include <unistd.h>
+
+// pread until size bytes are in or the file ends, returns bytes read
+static zr_u32_t __pread_all(int fd, void* buf, zr_u32_t size, zr_u32_t offset)
+{
+    zr_u32_t done = 0;
+
+    while(done < size) {
+        ssize_t n = pread(fd, (char*)buf + done, size - done, offset + done);
+        if(n <= 0)
+            break;
+        done += n;
+    }
+    return done;
+}
+
+static void* __worker(void* arg)
+{
+    zr_aio_t* aio = arg;
+
+    while(1) {
+        zr_aio_req_t req;
+        zr_u32_t done;
+
+        pthread_mutex_lock(&aio->lock);
+        while(aio->count == 0 && !aio->stop)
+            pthread_cond_wait(&aio->not_empty, &aio->lock);
+        if(aio->count == 0) {    // stopping and drained
+            pthread_mutex_unlock(&aio->lock);
+            return NULL;
+        }
+        req = aio->queue[aio->head];
+        aio->head = (aio->head + 1) % ZR_AIO_QUEUE_LEN;
+        aio->count--;
+        pthread_cond_signal(&aio->not_full);
+        pthread_mutex_unlock(&aio->lock);
+
+        done = __pread_all(aio->fd, req.buf, req.size, req.offset);
+        req.done(req.ctx, done == req.size ? (int)done : ZR_DISK_ERR);
+        pthread_mutex_lock(&aio->lock);
+        aio->completed++;
+        pthread_cond_broadcast(&aio->done);
+        pthread_mutex_unlock(&aio->lock);
+    }
+}
+
+int zr_aio_init(zr_aio_t* aio, int fd, int nthreads)
+{
+    if(nthreads < 1 || nthreads > ZR_AIO_MAX_THREADS)
+        return -1;
+    aio->fd = fd;
+    aio->stop = 0;
+    aio->head = aio->count = 0;
+    aio->completed = 0;
+    pthread_mutex_init(&aio->lock, NULL);
+    pthread_cond_init(&aio->not_empty, NULL);
+    pthread_cond_init(&aio->not_full, NULL);
+    pthread_cond_init(&aio->done, NULL);
+    for(aio->nthreads = 0; aio->nthreads < nthreads; aio->nthreads++) {
+        if(pthread_create(&aio->threads[aio->nthreads], NULL, __worker, aio)
+            != 0)
+            break;
+    }
+    return aio->nthreads > 0 ? 0 : -1;    // run with the workers we got
+}
+
+void zr_aio_deinit(zr_aio_t* aio)
+{
+    int i;
+
+    pthread_mutex_lock(&aio->lock);
+    aio->stop = 1;
+    pthread_cond_broadcast(&aio->not_empty);
+    pthread_mutex_unlock(&aio->lock);
+    for(i = 0; i < aio->nthreads; i++)
+        pthread_join(aio->threads[i], NULL);
+    pthread_cond_destroy(&aio->done);
+    pthread_cond_destroy(&aio->not_full);
+    pthread_cond_destroy(&aio->not_empty);
+    pthread_mutex_destroy(&aio->lock);
+}
+
+static void __readv(zr_fs_t* fs, const zr_iovec_t* iov, int iovcnt)
+{
+    zr_aio_t* aio = fs->user;
+    int i;
+
+    for(i = 0; i < iovcnt; i++) {    // no error path here, leave no stale bytes
+        zr_u32_t n = __pread_all(aio->fd, iov[i].buf, iov[i].size,
+            iov[i].offset);
+        memset((char*)iov[i].buf + n, 0, iov[i].size - n);
+    }
+}
+
+void zr_aio_attach(zr_aio_t* aio, zr_fs_t* fs)
+{
+    fs->user = aio;
+    fs->read_f = NULL;
+    fs->read_fv = __readv;
+    fs->read_async_f = zr_aio_read;
+    fs->poll_f = zr_aio_poll;
+}
+
+void zr_aio_read(zr_fs_t* fs, zr_u32_t offset, void* buf, zr_u32_t size,
+    zr_done_f done, void* ctx)
+{
+    zr_aio_t* aio = fs->user;
+    zr_aio_req_t* req;
+
+    pthread_mutex_lock(&aio->lock);
+    while(aio->count == ZR_AIO_QUEUE_LEN)
+        pthread_cond_wait(&aio->not_full, &aio->lock);
+    req = &aio->queue[(aio->head + aio->count) % ZR_AIO_QUEUE_LEN];
+    req->offset = offset;
+    req->size = size;
+    req->buf = buf;
+    req->done = done;
+    req->ctx = ctx;
+    aio->count++;
+    pthread_cond_signal(&aio->not_empty);
+    pthread_mutex_unlock(&aio->lock);
+}
+
+// the caller polls while one of its requests is out, so waiting for any
+// completion after this thread's last poll on aio never misses one that
+// landed in between; the first poll on an aio just returns
+void zr_aio_poll(zr_fs_t* fs, int wait)
+{
+    static __thread zr_aio_t* last;
+    static __thread unsigned long seen;
+    zr_aio_t* aio = fs->user;
+
+    if(!wait)
+        return;    // the workers pick requests up as they are queued
+    pthread_mutex_lock(&aio->lock);
+    while(last == aio && aio->completed == seen)
+        pthread_cond_wait(&aio->done, &aio->lock);
+    last = aio;
+    seen = aio->completed;
+    pthread_mutex_unlock(&aio->lock);
+}
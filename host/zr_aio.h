@@ -0,0 +1,47 @@
+#ifndef __ZR_AIO_H
+#define __ZR_AIO_H
+
+// Thread pool standing in for an async (DMA) flash driver on a Linux host.
+// Requests are served with pread() by worker threads, so completions come
+// back on a worker thread and, with more than one worker, out of order.
+
+#include <pthread.h>
+#include "../zromfs.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define ZR_AIO_MAX_THREADS 16
+#define ZR_AIO_QUEUE_LEN 64
+
+typedef struct {
+    zr_u32_t offset, size;
+    void* buf;
+    zr_done_f done;
+    void* ctx;
+} zr_aio_req_t;
+
+typedef struct {
+    int fd;
+    int nthreads, stop;
+    pthread_t threads[ZR_AIO_MAX_THREADS];
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty, not_full, done;
+    zr_aio_req_t queue[ZR_AIO_QUEUE_LEN];
+    int head, count;
+    unsigned long completed;    // requests whose callback has returned
+} zr_aio_t;
+
+int zr_aio_init(zr_aio_t* aio, int fd, int nthreads);      // start workers reading from fd
+void zr_aio_deinit(zr_aio_t* aio);                          // drain the queue and join workers
+void zr_aio_attach(zr_aio_t* aio, zr_fs_t* fs);             // back fs with the image: read_fv + read_async_f + poll_f
+void zr_aio_read(zr_fs_t* fs, zr_u32_t offset, void* buf, zr_u32_t size,
+    zr_done_f done, void* ctx);                             // read_async_f, blocks while the queue is full
+void zr_aio_poll(zr_fs_t* fs, int wait);                    // poll_f, with wait blocks until a request finishes
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,331 @@
+#include "zr_host.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+// a read that comes up short leaves zeros, like reading past the image
+static void __pread(zr_host_t* h, void* buf, zr_u32_t size, zr_u32_t offset)
+{
+    zr_u32_t done = 0;
+
+    while(done < size) {
+        ssize_t n = pread(h->fd, (char*)buf + done, size - done,
+            offset + done);
+        h->syscalls++;
+        if(n <= 0)
+            break;
+        done += n;
+    }
+    memset((char*)buf + done, 0, size - done);
+}
+
+// contiguous segments share one preadv()
+static void __preadv(zr_fs_t* fs, const zr_iovec_t* iov, int iovcnt)
+{
+    zr_host_t* h = fs->user;
+    struct iovec v[64];
+    int i, j;
+
+    for(i = 0; i < iovcnt; i = j) {
+        zr_u32_t total = 0;
+        ssize_t n;
+
+        for(j = i; j < iovcnt && j - i < 64 && (j == i
+            || iov[j].offset == iov[j - 1].offset + iov[j - 1].size); j++) {
+            v[j - i].iov_base = iov[j].buf;
+            v[j - i].iov_len = iov[j].size;
+            total += iov[j].size;
+        }
+        n = preadv(h->fd, v, j - i, iov[i].offset);
+        h->syscalls++;
+        if(n != total) {    // short, finish the segments one by one
+            zr_u32_t skip = n > 0 ? n : 0;
+            int k;
+            for(k = i; k < j; k++) {
+                if(skip >= iov[k].size)
+                    skip -= iov[k].size;
+                else {
+                    __pread(h, (char*)iov[k].buf + skip, iov[k].size - skip,
+                        iov[k].offset + skip);
+                    skip = 0;
+                }
+            }
+        }
+    }
+}
+
+static int __uring_init(zr_host_t* h)
+{
+    struct io_uring_params p;
+    char* sq;
+
+    memset(&p, 0, sizeof(p));
+    h->ring_fd = syscall(__NR_io_uring_setup, ZR_HOST_URING_DEPTH, &p);
+    if(h->ring_fd < 0)
+        return -errno;
+    h->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    h->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if(p.features & IORING_FEAT_SINGLE_MMAP) {
+        if(h->cq_len > h->sq_len)
+            h->sq_len = h->cq_len;
+        h->cq_len = 0;
+    }
+    h->sq_ring = mmap(NULL, h->sq_len, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, h->ring_fd, IORING_OFF_SQ_RING);
+    h->cq_ring = h->cq_len == 0 ? h->sq_ring : mmap(NULL, h->cq_len,
+        PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, h->ring_fd,
+        IORING_OFF_CQ_RING);
+    h->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    h->sqes = mmap(NULL, h->sqes_len, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, h->ring_fd, IORING_OFF_SQES);
+    if(h->sq_ring == MAP_FAILED || h->cq_ring == MAP_FAILED
+        || h->sqes == MAP_FAILED) {
+        close(h->ring_fd);
+        return -ENOMEM;
+    }
+    sq = h->sq_ring;
+    h->sq_tail = (unsigned*)(sq + p.sq_off.tail);
+    h->sq_mask = (unsigned*)(sq + p.sq_off.ring_mask);
+    h->sq_array = (unsigned*)(sq + p.sq_off.array);
+    h->cq_head = (unsigned*)((char*)h->cq_ring + p.cq_off.head);
+    h->cq_tail = (unsigned*)((char*)h->cq_ring + p.cq_off.tail);
+    h->cq_mask = (unsigned*)((char*)h->cq_ring + p.cq_off.ring_mask);
+    h->cqes = (char*)h->cq_ring + p.cq_off.cqes;
+    return 0;
+}
+
+static void __uring_push(zr_host_t* h, void* buf, zr_u32_t size,
+    zr_u32_t offset, unsigned tag)
+{
+    unsigned tail = *h->sq_tail, idx = tail & *h->sq_mask;
+    struct io_uring_sqe* sqe = (struct io_uring_sqe*)h->sqes + idx;
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = h->fd;
+    sqe->addr = (unsigned long)buf;
+    sqe->len = size;
+    sqe->off = offset;
+    sqe->user_data = tag;
+    h->sq_array[idx] = idx;
+    __atomic_store_n(h->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    h->queued++;
+}
+
+static void __preadv(zr_fs_t* fs, const zr_iovec_t* iov, int iovcnt);
+
+// the ring is unusable: finish what is in it with pread, stop using it
+static void __uring_fail(zr_host_t* h)
+{
+    unsigned i;
+
+    for(i = 0; i < ZR_HOST_URING_DEPTH; i++) {
+        zr_host_req_t* r = &h->reqs[i];
+        if((h->req_used & ~h->req_done) & (1UL << i)) {
+            __pread(h, r->buf, r->size, r->offset);
+            h->req_done |= 1UL << i;
+        }
+    }
+    h->queued = h->inflight = 0;
+    h->fs->read_fv = __preadv;
+    h->fs->read_async_f = NULL;
+}
+
+// submit the queue, wait for wait completions, handle all that are there.
+// Tags below ZR_HOST_URING_DEPTH are segments of iov, the rest reqs[]
+// slots, which are only marked done here. Returns the iov segments
+// completed, -1 if the ring failed.
+static int __uring_enter(zr_host_t* h, const zr_iovec_t* iov, unsigned wait)
+{
+    unsigned head;
+    int ret, segs = 0;
+
+    ret = syscall(__NR_io_uring_enter, h->ring_fd, h->queued, wait,
+        wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    if(ret < 0 && errno != EINTR) {
+        __uring_fail(h);
+        return -1;
+    }
+    h->syscalls++;
+    if(ret > 0) {
+        h->queued -= ret;
+        h->inflight += ret;
+    }
+    while((head = *h->cq_head) != __atomic_load_n(h->cq_tail,
+        __ATOMIC_ACQUIRE)) {
+        struct io_uring_cqe* cqe = (struct io_uring_cqe*)h->cqes
+            + (head & *h->cq_mask);
+        zr_u32_t done = cqe->res > 0 ? cqe->res : 0;
+        unsigned tag = cqe->user_data;
+        const zr_iovec_t* v = NULL;
+        zr_host_req_t* r = NULL;
+
+        __atomic_store_n(h->cq_head, head + 1, __ATOMIC_RELEASE);
+        h->inflight--;
+        if(tag < ZR_HOST_URING_DEPTH) {
+            v = &iov[tag];
+            segs++;
+        }
+        else {
+            r = &h->reqs[tag - ZR_HOST_URING_DEPTH];
+            h->req_done |= 1UL << (tag - ZR_HOST_URING_DEPTH);
+        }
+        if(v != NULL && done < v->size)
+            __pread(h, (char*)v->buf + done, v->size - done, v->offset + done);
+        if(r != NULL && done < r->size)
+            __pread(h, (char*)r->buf + done, r->size - done, r->offset + done);
+    }
+    return segs;
+}
+
+// call done for finished async reads, returns how many
+static int __uring_complete(zr_host_t* h)
+{
+    int n = 0;
+    unsigned i;
+
+    for(i = 0; h->req_done != 0 && i < ZR_HOST_URING_DEPTH; i++) {
+        if(h->req_done & (1UL << i)) {    // free the slot first, done may queue the next read
+            zr_host_req_t r = h->reqs[i];
+            h->req_done &= ~(1UL << i);
+            h->req_used &= ~(1UL << i);
+            r.done(r.ctx, r.size);
+            n++;
+        }
+    }
+    return n;
+}
+
+// all segments in one submission, one io_uring_enter() per batch
+static void __uring_readv(zr_fs_t* fs, const zr_iovec_t* iov, int iovcnt)
+{
+    zr_host_t* h = fs->user;
+    int i, n, got, ret;
+
+    for(; iovcnt > 0; iov += n, iovcnt -= n) {
+        while(h->queued + h->inflight == ZR_HOST_URING_DEPTH)
+            if(__uring_enter(h, NULL, 1) < 0)
+                break;
+        if(fs->read_fv != __uring_readv) {
+            __preadv(fs, iov, iovcnt);
+            return;
+        }
+        n = ZR_HOST_URING_DEPTH - h->queued - h->inflight;
+        if(n > iovcnt)
+            n = iovcnt;
+        for(i = 0; i < n; i++)
+            __uring_push(h, iov[i].buf, iov[i].size, iov[i].offset, i);
+        for(got = 0; got < n; got += ret) {
+            ret = __uring_enter(h, iov, n - got);
+            if(ret < 0) {    // the ring is gone, read it all again
+                __preadv(fs, iov, iovcnt);
+                return;
+            }
+        }
+    }
+}
+
+static void __uring_async(zr_fs_t* fs, zr_u32_t offset, void* buf,
+    zr_u32_t size, zr_done_f done, void* ctx)
+{
+    zr_host_t* h = fs->user;
+    zr_host_req_t* r;
+    unsigned i;
+
+    while(h->queued + h->inflight == ZR_HOST_URING_DEPTH)
+        if(__uring_enter(h, NULL, 1) < 0)
+            break;
+    if(fs->read_async_f != __uring_async) {
+        __pread(h, buf, size, offset);
+        done(ctx, size);
+        return;
+    }
+    if(h->req_used == (zr_u32_t)((2ULL << (ZR_HOST_URING_DEPTH - 1)) - 1))
+        __uring_complete(h);    // all slots finished or in the ring
+    for(i = 0; h->req_used & (1UL << i); i++)
+        ;
+    h->req_used |= 1UL << i;
+    r = &h->reqs[i];
+    r->done = done;
+    r->ctx = ctx;
+    r->buf = buf;
+    r->offset = offset;
+    r->size = size;
+    __uring_push(h, buf, size, offset, ZR_HOST_URING_DEPTH + i);
+}
+
+int zr_host_poll(zr_host_t* h, int wait)
+{
+    if(h->kind != ZR_HOST_URING || h->fs == NULL)
+        return 0;
+    while(h->queued + h->inflight > 0
+        && h->fs->read_async_f == __uring_async) {
+        if(__uring_enter(h, NULL, wait ? 1 : 0) < 0 || !wait)
+            break;
+    }
+    return __uring_complete(h);
+}
+
+static void __uring_poll(zr_fs_t* fs, int wait)
+{
+    zr_host_poll(fs->user, wait);
+}
+
+int zr_host_open(zr_host_t* h, const char* path, int kind)
+{
+    struct stat st;
+
+    memset(h, 0, sizeof(*h));
+    h->fd = open(path, O_RDONLY | O_CLOEXEC);
+    if(h->fd < 0 || fstat(h->fd, &st) != 0) {
+        int err = -errno;
+        if(h->fd >= 0)
+            close(h->fd);
+        return err;
+    }
+    h->size = st.st_size;
+    h->kind = kind;
+    if(kind == ZR_HOST_MMAP) {
+        h->map = mmap(NULL, h->size, PROT_READ, MAP_SHARED, h->fd, 0);
+        if(h->map == MAP_FAILED) {
+            close(h->fd);
+            return -errno;
+        }
+    }
+    else if(kind == ZR_HOST_URING && __uring_init(h) != 0)
+        h->kind = ZR_HOST_PREAD;    // no io_uring here, or not allowed
+    return h->kind;
+}
+
+void zr_host_attach(zr_host_t* h, zr_fs_t* fs)
+{
+    h->fs = fs;
+    fs->user = h;
+    fs->read_f = NULL;
+    fs->read_fv = h->kind == ZR_HOST_URING ? __uring_readv : __preadv;
+    fs->read_async_f = h->kind == ZR_HOST_URING ? __uring_async : NULL;
+    fs->poll_f = h->kind == ZR_HOST_URING ? __uring_poll : NULL;
+    fs->base = h->kind == ZR_HOST_MMAP ? h->map : NULL;
+}
+
+void zr_host_close(zr_host_t* h)
+{
+    if(h->kind == ZR_HOST_MMAP)
+        munmap(h->map, h->size);
+    if(h->kind == ZR_HOST_URING) {
+        zr_host_poll(h, 1);
+        munmap(h->sqes, h->sqes_len);
+        if(h->cq_ring != h->sq_ring)
+            munmap(h->cq_ring, h->cq_len);
+        munmap(h->sq_ring, h->sq_len);
+        close(h->ring_fd);
+    }
+    close(h->fd);
+}
@@ -0,0 +1,61 @@
+#ifndef __ZR_HOST_H
+#define __ZR_HOST_H
+
+// Linux read providers for romfs image files, for host tools and servers.
+// All of them go through fs->user, so any number of images can be open at
+// once. pread serves a read in one syscall, merging contiguous segments of
+// a scatter read into one preadv(). mmap maps the image and sets fs->base,
+// reads are then plain loads. io_uring queues every segment of a scatter
+// read and submits and reaps them with a single io_uring_enter(). It also
+// serves zr_file_read_async(): requests only queue up until zr_host_poll()
+// or a full ring submits them all at once, done is called from zr_host_poll(),
+// which zr_file_stream() reaches through fs->poll_f.
+
+#include "../zromfs.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define ZR_HOST_URING_DEPTH 32  // io_uring entries, larger batches are split, at most 32
+
+enum {
+    ZR_HOST_PREAD,
+    ZR_HOST_MMAP,
+    ZR_HOST_URING
+};
+
+typedef struct {
+    zr_done_f done;
+    void* ctx;
+    void* buf;
+    zr_u32_t offset, size;
+} zr_host_req_t;
+
+typedef struct {
+    int fd, kind;
+    zr_u32_t size;              // image file size
+    zr_u32_t syscalls;          // read syscalls so far, mmap counts none
+    void* map;                  // ZR_HOST_MMAP
+    int ring_fd;                // ZR_HOST_URING, the rest points into the rings
+    void* sq_ring, * cq_ring, * sqes, * cqes;
+    zr_u32_t sq_len, cq_len, sqes_len;
+    unsigned* sq_tail, * sq_mask, * sq_array;
+    unsigned* cq_head, * cq_tail, * cq_mask;
+    unsigned queued, inflight;  // in the ring, not submitted yet and submitted
+    zr_u32_t req_used;          // 1 bit per busy reqs[] slot
+    zr_u32_t req_done;          // and per slot whose data is in, done not called yet
+    zr_host_req_t reqs[ZR_HOST_URING_DEPTH];
+    zr_fs_t* fs;
+} zr_host_t;
+
+int zr_host_open(zr_host_t* h, const char* path, int kind);    // the kind in use or -errno, io_uring falls back to pread
+void zr_host_attach(zr_host_t* h, zr_fs_t* fs);                 // back fs with the image
+int zr_host_poll(zr_host_t* h, int wait);                   // submit queued async reads, call done for finished ones, all of them with wait
+void zr_host_close(zr_host_t* h);                           // waits for async reads first
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,102 @@
+#include "zr_spinor.h"
+
+#include <string.h>
+
+// lines for command, address and data, then the usual dummy clocks
+static const zr_u8_t modes[ZR_SPINOR_MODES][4] = {
+    {1, 1, 1, 0},
+    {1, 1, 1, 8},
+    {1, 1, 2, 8},
+    {1, 2, 2, 4},
+    {1, 1, 4, 8},
+    {1, 4, 4, 6},
+    {4, 4, 4, 6},
+};
+
+const char* const zr_spinor_names[ZR_SPINOR_MODES] = {"read", "fast_read",
+    "dual_out", "dual_io", "quad_out", "quad_io", "qpi"};
+
+// clocks to move bits over lines, rounded up
+static zr_u32_t __clocks(zr_u32_t bits, zr_u32_t lines)
+{
+    return (bits + lines - 1) / lines;
+}
+
+double zr_spinor_cost(const zr_spinor_t* s, zr_u32_t offset, zr_u32_t size)
+{
+    zr_u32_t clocks = __clocks(8, s->cmd_lines)
+        + __clocks(s->addr_bytes * 8, s->addr_lines) + s->dummy
+        + __clocks(size * 8, s->data_lines);
+    double ns = s->setup_ns + clocks * 1e9 / s->clock_hz;
+
+    if(s->boundary != 0 && size != 0)
+        ns += (double)s->cross_ns * (((offset + size - 1) / s->boundary)
+            - offset / s->boundary);
+    return ns;
+}
+
+static void __command(zr_spinor_t* s, zr_u32_t offset, zr_u32_t size)
+{
+    s->ns += zr_spinor_cost(s, offset, size);
+    s->reads++;
+    s->bytes += size;
+    if(s->boundary != 0 && size != 0)
+        s->crossings += (offset + size - 1) / s->boundary - offset / s->boundary;
+}
+
+static void __copy(zr_spinor_t* s, void* buf, zr_u32_t offset, zr_u32_t size)
+{
+    zr_u32_t n = offset < s->size ? s->size - offset : 0;
+
+    if(n > size)
+        n = size;
+    memcpy(buf, s->img + offset, n);
+    memset((zr_u8_t*)buf + n, 0xFF, size - n);
+}
+
+// contiguous segments are one command, the clock just keeps running
+static void __readv(zr_fs_t* fs, const zr_iovec_t* iov, int iovcnt)
+{
+    zr_spinor_t* s = fs->user;
+    int i, j;
+
+    for(i = 0; i < iovcnt; i = j) {
+        zr_u32_t total = 0;
+        for(j = i; j < iovcnt && (j == i
+            || iov[j].offset == iov[j - 1].offset + iov[j - 1].size); j++) {
+            __copy(s, iov[j].buf, iov[j].offset, iov[j].size);
+            total += iov[j].size;
+        }
+        __command(s, iov[i].offset, total);
+    }
+}
+
+void zr_spinor_init(zr_spinor_t* s, const void* img, zr_u32_t size, int mode,
+    zr_u32_t clock_hz)
+{
+    memset(s, 0, sizeof(*s));
+    s->img = img;
+    s->size = size;
+    s->clock_hz = clock_hz;
+    s->cmd_lines = modes[mode][0];
+    s->addr_lines = modes[mode][1];
+    s->data_lines = modes[mode][2];
+    s->dummy = modes[mode][3];
+    s->addr_bytes = size > (1UL << 24) ? 4 : 3;
+}
+
+void zr_spinor_attach(zr_spinor_t* s, zr_fs_t* fs)
+{
+    fs->user = s;
+    fs->read_f = NULL;
+    fs->read_fv = __readv;
+    fs->read_async_f = NULL;
+    fs->poll_f = NULL;
+    fs->base = NULL;
+}
+
+void zr_spinor_reset(zr_spinor_t* s)
+{
+    s->reads = s->bytes = s->crossings = 0;
+    s->ns = 0;
+}
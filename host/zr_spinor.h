@@ -0,0 +1,56 @@
+#ifndef __ZR_SPINOR_H
+#define __ZR_SPINOR_H
+
+// Emulated SPI NOR flash over an image in memory, to see what a change
+// costs on a real target without one. Every backend read is one read
+// command on the bus: opcode, address and dummy cycles, then the data, on
+// as many lines as the mode uses for each phase, plus a fixed setup time
+// per transaction for chip select, driver and DMA. Reads that cross a
+// multiple of boundary can pay cross_ns more, for parts or controllers
+// that stall there. Contiguous segments of a scatter read are one command.
+// The projected bus time adds up in ns. Not locked, one thread at a time.
+
+#include "../zromfs.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum {
+    ZR_SPINOR_READ,             // 03h, 1-1-1, no dummy cycles, most parts take it up to about 50 MHz only
+    ZR_SPINOR_FAST_READ,        // 0Bh, 1-1-1
+    ZR_SPINOR_DUAL_OUT,         // 3Bh, 1-1-2
+    ZR_SPINOR_DUAL_IO,          // BBh, 1-2-2
+    ZR_SPINOR_QUAD_OUT,         // 6Bh, 1-1-4
+    ZR_SPINOR_QUAD_IO,          // EBh, 1-4-4
+    ZR_SPINOR_QPI,              // EBh in QPI mode, 4-4-4
+    ZR_SPINOR_MODES
+};
+
+typedef struct {
+    const zr_u8_t* img;
+    zr_u32_t size;              // reads past it return 0xFF, like erased flash
+    zr_u32_t clock_hz;
+    zr_u8_t cmd_lines, addr_lines, data_lines;    // bus width of each phase
+    zr_u8_t dummy;              // dummy clocks, mode bits included
+    zr_u8_t addr_bytes;         // 3, or 4 for parts over 16 MiB
+    zr_u32_t setup_ns;          // fixed cost of every transaction
+    zr_u32_t boundary;          // power of 2, reads crossing a multiple of it pay cross_ns, 0 = none
+    zr_u32_t cross_ns;
+    zr_u32_t reads, bytes, crossings;
+    double ns;                  // projected bus time so far
+} zr_spinor_t;
+
+extern const char* const zr_spinor_names[ZR_SPINOR_MODES];
+
+void zr_spinor_init(zr_spinor_t* s, const void* img, zr_u32_t size, int mode,
+    zr_u32_t clock_hz);                                     // phases and dummy cycles of a mode, no setup or crossing cost
+void zr_spinor_attach(zr_spinor_t* s, zr_fs_t* fs);         // back fs with the flash
+double zr_spinor_cost(const zr_spinor_t* s, zr_u32_t offset, zr_u32_t size);    // ns of one read command
+void zr_spinor_reset(zr_spinor_t* s);                       // clear the counters
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
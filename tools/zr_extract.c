@@ -0,0 +1,340 @@
+// Extracts a romfs image into a directory on a pool of worker threads.
+//
+//   zr_extract [-j threads] [-v] image outdir
+//
+// The tree is walked once on the main thread, by header offsets so names
+// of any length work, creating directories and symlinks and listing the
+// files. Workers then copy the files largest first, straight from the
+// image with copy_file_range(), or sendfile() where the kernel or the file
+// systems can't, so file data never passes through a user space buffer.
+// Files compressed by zr_mkromfs -z are decoded with zr_file_read()
+// instead. Existing files in outdir are overwritten, symlinks are made
+// last so nothing is ever written through one. Names with a '/', empty
+// names and directories listed twice are skipped.
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include "../zromfs.h"
+
+#define MAX_THREADS 64
+#define MAX_DEPTH 256           // directory levels, keeps a damaged image off the stack
+#define PAD16(n) (((n) + 15) & ~15UL)
+
+typedef struct {
+    char* out;                  // path on the host
+    char* path;                 // path in the image, for compressed files, or the link target
+    zr_u32_t offset, size;      // data in the image
+    int mode;
+} job_t;
+
+static struct {
+    int fd;
+    zr_fs_t fs;
+    job_t* jobs, * links;       // links are made after all files
+    int njobs, cap, next, errors, nlinks, links_cap;
+    zr_u8_t* seen;              // a bit per 16 bytes of image, directory lists walked
+    double bytes;
+} g;
+
+static void read_f(zr_u32_t offset, void* buf, zr_u32_t size)
+{
+    if(pread(g.fd, buf, size, offset) != size)
+        memset(buf, 0, size);
+}
+
+static zr_u32_t get_be(const zr_u8_t* p)
+{
+    return (zr_u32_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+// a name padded to 16 bytes, returns the offset after it
+static zr_u32_t read_name(zr_u32_t offset, char* name)
+{
+    zr_u32_t len = 0;
+
+    do {
+        read_f(offset + len, name + len, 16);
+        len += 16;
+    } while(name[len - 1] != '\0' && len < NAME_MAX);
+    name[len - 1] = '\0';
+    return offset + len;
+}
+
+// header at offset: next|type, spec, size, and the name, returns data offset
+static zr_u32_t read_hdr(zr_u32_t offset, zr_u32_t h[3], char* name)
+{
+    zr_u8_t buf[16];
+
+    read_f(offset, buf, 16);
+    h[0] = get_be(buf);
+    h[1] = get_be(buf + 4);
+    h[2] = get_be(buf + 8);
+    return read_name(offset + 16, name);
+}
+
+static void add_job(const char* out, const char* path, zr_u32_t offset,
+    zr_u32_t size, int mode)
+{
+    job_t* j;
+
+    if(g.njobs == g.cap) {
+        g.cap = g.cap ? g.cap * 2 : 256;
+        g.jobs = realloc(g.jobs, g.cap * sizeof(job_t));
+    }
+    j = &g.jobs[g.njobs++];
+    j->out = strdup(out);
+    j->path = path ? strdup(path) : NULL;
+    j->offset = offset;
+    j->size = size;
+    j->mode = mode;
+}
+
+static void fail(const char* what)
+{
+    perror(what);
+    __atomic_fetch_add(&g.errors, 1, __ATOMIC_RELAXED);
+}
+
+static void add_link(const char* out, char* target)
+{
+    if(g.nlinks == g.links_cap) {
+        g.links_cap = g.links_cap ? g.links_cap * 2 : 64;
+        g.links = realloc(g.links, g.links_cap * sizeof(job_t));
+    }
+    g.links[g.nlinks].out = strdup(out);
+    g.links[g.nlinks++].path = target;
+}
+
+// 1 if the list at offset was walked before, marks it
+static int seen(zr_u32_t offset)
+{
+    zr_u32_t b = offset / 16;
+
+    if(g.seen[b / 8] & (1 << b % 8))
+        return 1;
+    g.seen[b / 8] |= 1 << b % 8;
+    return 0;
+}
+
+static void bad(const char* path, const char* what)
+{
+    fprintf(stderr, "%s: %s\n", *path ? path : "/", what);
+    g.errors++;
+}
+
+// one directory list, dirs are made here, files and links become jobs
+static void walk(zr_u32_t list, const char* path, const char* out, int depth)
+{
+    zr_dir_t dir = {&g.fs, list};
+    zr_finfo_t finfo;
+    int ret;
+
+    if(depth > MAX_DEPTH || list >= g.fs.size || seen(list)) {
+        bad(path, "skipped, directory nested too deep or listed twice");
+        return;
+    }
+    while((ret = zr_readdir(&dir, &finfo)) == ZR_OK) {
+        char name[NAME_MAX + 16], tname[NAME_MAX + 16];
+        char sub[PATH_MAX], osub[PATH_MAX];
+        zr_u32_t h[3], data, target = finfo.offset;
+        struct stat st;
+
+        data = read_hdr(finfo.offset, h, name);
+        if(strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
+            continue;
+        if(name[0] == '\0' || strchr(name, '/') != NULL) {
+            bad(path, "skipped an empty name or one with a '/'");
+            continue;
+        }
+        if((h[0] & 7) == ZR_FTYPE_HARDLINK) {    // files of packed images
+            target = h[1] & ~0xf;
+            data = read_hdr(target, h, tname);
+        }
+        if(snprintf(sub, sizeof(sub), "%s/%s", path, name) >= sizeof(sub)
+            || snprintf(osub, sizeof(osub), "%s/%s", out, name)
+            >= sizeof(osub)) {
+            bad(path, "skipped, path too long");
+            continue;
+        }
+
+        switch(h[0] & 7) {
+            case ZR_FTYPE_DIR:
+                if(mkdir(osub, 0755) != 0 && errno != EEXIST)
+                    fail(osub);
+                else if(lstat(osub, &st) != 0 || !S_ISDIR(st.st_mode))
+                    bad(osub, "skipped, not a directory on the host");
+                else
+                    walk(h[1] & ~0xf, sub, osub, depth + 1);
+                break;
+            case ZR_FTYPE_REGULAR:
+                if(*path == '\0' && strcmp(name, ".zrindex") == 0)
+                    break;    // zr_mkindex metadata
+                if(h[1] == 0)
+                    add_job(osub, NULL, data, h[2], h[0] & 8 ? 0755 : 0644);
+                else if(ZR_LZ4_BLOCK_SIZE > 0)    // compressed, zr_file_open() finds it by path
+                    add_job(osub, sub, 0, h[1], h[0] & 8 ? 0755 : 0644);
+                else
+                    fprintf(stderr, "%s: skipped, compressed\n", sub);
+                break;
+            case ZR_FTYPE_SYMBOL_LINK: {
+                char* link = calloc(1, h[2] + 1);
+                read_f(data, link, h[2]);
+                add_link(osub, link);
+                break;
+            }
+            default:
+                fprintf(stderr, "%s: skipped, type %lu\n", sub,
+                    (unsigned long)(h[0] & 7));
+                break;
+        }
+    }
+    if(ret != ZR_NO_FILE)
+        bad(path, "damaged directory list");
+}
+
+// image to out without a user space copy
+static int copy_range(int out, zr_u32_t offset, zr_u32_t size)
+{
+    loff_t in = offset;
+    int use_sendfile = 0;
+
+    while(size > 0) {
+        ssize_t n = -1;
+        if(!use_sendfile) {
+            n = copy_file_range(g.fd, &in, out, NULL, size, 0);
+            if(n < 0 && (errno == EXDEV || errno == ENOSYS || errno == EINVAL
+                || errno == EOPNOTSUPP)) {
+                use_sendfile = 1;
+                continue;
+            }
+        }
+        else {
+            off_t o = in;
+            n = sendfile(out, g.fd, &o, size);
+            in = o;
+        }
+        if(n <= 0)
+            return -1;
+        size -= n;
+    }
+    return 0;
+}
+
+// compressed files go through the library, one zr_file_t per worker
+static int copy_decoded(int out, const char* path)
+{
+    static __thread zr_file_t fp;
+    static __thread char buf[65536];
+    int n;
+
+    if(zr_file_open(&g.fs, &fp, path) != ZR_OK)
+        return -1;
+    while((n = zr_file_read(&fp, buf, sizeof(buf))) > 0)
+        if(write(out, buf, n) != n)
+            break;
+    zr_file_close(&fp);
+    return n == 0 ? 0 : -1;
+}
+
+static void* worker(void* arg)
+{
+    int i;
+
+    while((i = __atomic_fetch_add(&g.next, 1, __ATOMIC_RELAXED)) < g.njobs) {
+        job_t* j = &g.jobs[i];
+        int out = open(j->out, O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW,
+            j->mode);
+        if(out < 0) {
+            fail(j->out);
+            continue;
+        }
+        if((j->path ? copy_decoded(out, j->path)
+            : copy_range(out, j->offset, j->size)) != 0)
+            fail(j->out);
+        close(out);
+    }
+    return NULL;
+}
+
+static int cmp_size(const void* a, const void* b)
+{
+    const job_t* x = a, * y = b;
+    return x->size > y->size ? -1 : x->size < y->size;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int main(int argc, char* argv[])
+{
+    pthread_t threads[MAX_THREADS];
+    int opt, i, nthreads = sysconf(_SC_NPROCESSORS_ONLN), verbose = 0;
+    char name[NAME_MAX + 16];
+    double t0 = now();
+
+    while((opt = getopt(argc, argv, "j:v")) != -1) {
+        if(opt == 'j')
+            nthreads = atoi(optarg);
+        else if(opt == 'v')
+            verbose = 1;
+        else
+            optind = argc;
+    }
+    if(optind + 2 != argc) {
+        fputs("Usage: zr_extract [-j threads] [-v] image outdir\n", stderr);
+        return 1;
+    }
+    if(nthreads < 1)
+        nthreads = 1;
+    if(nthreads > MAX_THREADS)
+        nthreads = MAX_THREADS;
+
+    g.fd = open(argv[optind], O_RDONLY);
+    if(g.fd < 0) {
+        perror(argv[optind]);
+        return 1;
+    }
+    g.fs.read_f = read_f;
+    if(zr_fs_mount(&g.fs) != ZR_OK) {
+        fprintf(stderr, "%s: not a romfs image\n", argv[optind]);
+        return 1;
+    }
+    if(mkdir(argv[optind + 1], 0755) != 0 && errno != EEXIST) {
+        perror(argv[optind + 1]);
+        return 1;
+    }
+    g.seen = calloc(g.fs.size / 128 + 1, 1);
+    walk(read_name(16, name), "", argv[optind + 1], 0);    // root list after the volume name
+
+    qsort(g.jobs, g.njobs, sizeof(job_t), cmp_size);
+    for(i = 0; i < g.njobs; i++)
+        g.bytes += g.jobs[i].size;
+    for(i = 0; i < nthreads; i++)
+        pthread_create(&threads[i], NULL, worker, NULL);
+    for(i = 0; i < nthreads; i++)
+        pthread_join(threads[i], NULL);
+    for(i = 0; i < g.nlinks; i++) {
+        unlink(g.links[i].out);
+        if(symlink(g.links[i].path, g.links[i].out) != 0)
+            fail(g.links[i].out);
+    }
+
+    if(verbose)
+        fprintf(stderr, "%d files, %.0f bytes, %d threads, %.3f s\n",
+            g.njobs, g.bytes, nthreads, now() - t0);
+    return g.errors != 0;
+}
@@ -0,0 +1,218 @@
+// Checks romfs images with zr_fsck() on a pool of worker threads.
+//
+//   zr_fsck [-j threads] [-d] [-q] image...
+//
+// Every image is mapped and mounted on the main thread, which checks the
+// entries of the root directory. Once those are sound, each directory
+// below the root is checked as a job of its own, so the workers share big
+// images as well as many small ones. Each worker has its own visited set,
+// cycles that run across two top-level directories show up as a header
+// reached twice only within one of them, or as ZR_MAX_DEPTH. -d also hashes
+// file contents, the printed data sum is the same however the jobs were
+// split. -q only prints images with errors. Exits with 1 if any image
+// has errors.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "../zromfs.h"
+
+#define MAX_THREADS 64
+
+typedef struct {
+    const char* name;
+    void* map;
+    zr_u32_t size;
+    zr_fs_t fs;
+    int mounted;
+    zr_fsck_t sum;              // all jobs of the image added up
+    pthread_mutex_t lock;
+} image_t;
+
+typedef struct {
+    image_t* im;
+    char* path;
+} job_t;
+
+static const char* errors[] = {"", "out of bounds", "bad checksum", "cycle",
+    "bad type"};
+
+static struct {
+    job_t* jobs;
+    int njobs, cap, next, flags;
+    zr_u32_t max_size;          // largest image, for the visited sets
+    pthread_mutex_t lock;
+} g = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+static void add(zr_fsck_t* sum, const zr_fsck_t* r)
+{
+    if(sum->errors == 0 && r->errors != 0) {
+        sum->bad = r->bad;
+        sum->error = r->error;
+    }
+    sum->headers += r->headers;
+    sum->dirs += r->dirs;
+    sum->files += r->files;
+    sum->bytes += r->bytes;
+    sum->data_sum += r->data_sum;
+    sum->errors += r->errors;
+}
+
+static void push(image_t* im, const char* path)
+{
+    if(g.njobs == g.cap) {
+        g.cap = g.cap ? g.cap * 2 : 256;
+        g.jobs = realloc(g.jobs, g.cap * sizeof(job_t));
+    }
+    g.jobs[g.njobs].im = im;
+    g.jobs[g.njobs].path = strdup(path);
+    g.njobs++;
+}
+
+// map, mount, check the root entries, queue the directories below
+static void open_image(image_t* im, const char* name)
+{
+    zr_finfo_t items[32];
+    char names[1024], * p, sub[2048];
+    struct stat st;
+    zr_dir_t dir;
+    zr_fsck_t r = {0};
+    int fd, i, n;
+
+    im->name = name;
+    pthread_mutex_init(&im->lock, NULL);
+    fd = open(name, O_RDONLY);
+    if(fd < 0 || fstat(fd, &st) != 0) {
+        perror(name);
+        if(fd >= 0)
+            close(fd);
+        return;
+    }
+    im->size = st.st_size;
+    im->map = mmap(NULL, im->size ? im->size : 1, PROT_READ, MAP_PRIVATE, fd,
+        0);
+    close(fd);
+    if(im->map == MAP_FAILED) {
+        perror(name);
+        return;
+    }
+    im->fs.base = im->map;
+    if(im->size < 512 || zr_fs_mount(&im->fs) != ZR_OK
+        || im->fs.size > im->size)
+        return;
+    im->mounted = 1;
+    if(im->size > g.max_size)
+        g.max_size = im->size;
+
+    r.map_size = ZR_FSCK_MAP_BYTES(im->size);
+    r.map = malloc(r.map_size);
+    zr_fsck(&im->fs, "", g.flags | ZR_FSCK_SHALLOW, &r);
+    free(r.map);
+    add(&im->sum, &r);
+    if(r.errors != 0)
+        return;    // the list itself may loop
+    zr_fs_opendir(&im->fs, &dir, "");
+    while((n = zr_readdir_batch(&dir, items, 32, names, sizeof(names),
+        ZR_READDIR_SKIP_DOTS)) > 0) {
+        for(i = 0, p = names; i < n; p += strlen(p) + 1, i++) {
+            if(items[i].ftype != ZR_FTYPE_DIR)
+                continue;
+            snprintf(sub, sizeof(sub), "/%s", p);
+            push(im, sub);
+        }
+    }
+}
+
+static void* worker(void* arg)
+{
+    zr_fsck_t r = {0};
+
+    r.map_size = ZR_FSCK_MAP_BYTES(g.max_size);
+    r.map = malloc(r.map_size);
+    while(1) {
+        job_t* j;
+        zr_u32_t size;
+
+        pthread_mutex_lock(&g.lock);
+        j = g.next < g.njobs ? &g.jobs[g.next++] : NULL;
+        pthread_mutex_unlock(&g.lock);
+        if(j == NULL)
+            break;
+        size = r.map_size;    // only clear what this image needs
+        r.map_size = ZR_FSCK_MAP_BYTES(j->im->size);
+        if(zr_fsck(&j->im->fs, j->path, g.flags, &r) == ZR_DIR_NOT_FOUND) {
+            r.errors = 1;
+            r.error = ZR_FSCK_TYPE;
+            r.bad = 0;
+        }
+        r.map_size = size;
+        pthread_mutex_lock(&j->im->lock);
+        add(&j->im->sum, &r);
+        pthread_mutex_unlock(&j->im->lock);
+    }
+    free(r.map);
+    return NULL;
+}
+
+int main(int argc, char* argv[])
+{
+    pthread_t threads[MAX_THREADS];
+    image_t* images;
+    int i, opt, nthreads = sysconf(_SC_NPROCESSORS_ONLN), quiet = 0, bad = 0;
+
+    while((opt = getopt(argc, argv, "j:dq")) != -1) {
+        switch(opt) {
+            case 'j': nthreads = atoi(optarg); break;
+            case 'd': g.flags |= ZR_FSCK_DATA; break;
+            case 'q': quiet = 1; break;
+            default: argc = 0;
+        }
+    }
+    if(optind >= argc) {
+        fputs("Usage: zr_fsck [-j threads] [-d] [-q] image...\n", stderr);
+        return 1;
+    }
+    if(nthreads < 1)
+        nthreads = 1;
+    if(nthreads > MAX_THREADS)
+        nthreads = MAX_THREADS;
+
+    images = calloc(argc - optind, sizeof(image_t));
+    for(i = optind; i < argc; i++)
+        open_image(&images[i - optind], argv[i]);
+    for(i = 0; i < nthreads; i++)
+        pthread_create(&threads[i], NULL, worker, NULL);
+    for(i = 0; i < nthreads; i++)
+        pthread_join(threads[i], NULL);
+
+    for(i = 0; i < argc - optind; i++) {
+        image_t* im = &images[i];
+        zr_fsck_t* s = &im->sum;
+
+        if(!im->mounted) {
+            printf("%s: not a romfs image\n", im->name);
+            bad = 1;
+            continue;
+        }
+        bad |= s->errors != 0;
+        if(s->errors == 0 && quiet)
+            continue;
+        printf("%s: %lu headers, %lu dirs, %lu files, %lu bytes", im->name,
+            (unsigned long)s->headers, (unsigned long)s->dirs,
+            (unsigned long)s->files, (unsigned long)s->bytes);
+        if(g.flags & ZR_FSCK_DATA)
+            printf(", data %08lx", (unsigned long)s->data_sum);
+        if(s->errors == 0)
+            printf(", ok\n");
+        else
+            printf(", %lu errors, first: %s at %#lx\n",
+                (unsigned long)s->errors, errors[s->error],
+                (unsigned long)s->bad);
+    }
+    return bad;
+}
@@ -0,0 +1,211 @@
+// Appends a lookup index to a romfs image as a hidden ".zrindex" file.
+//
+//   zr_mkindex [-v] image [out_image]
+//
+// The file is linked right after the root's "..", where zr_mount looks
+// for it, and holds an open-addressed table keyed by the same two path
+// hashes as the RAM index, so zr_stat/zr_open/zr_opendir find any path
+// with one or two reads and no mount-time scan. Other romfs readers just
+// see one more file. All entries keep their offsets, the index is added
+// at the end of the image. See __img_index_init() in zromfs.c for the
+// format.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define SLOT_WORDS 7            // hash, check, offset, next, spec, size, data
+
+static struct {
+    unsigned char* img;
+    unsigned long len;
+    unsigned long* slots;       // SLOT_WORDS per entry, host order
+    unsigned long n, used;
+} g;
+
+static unsigned long get_be(unsigned long offset)
+{
+    return (unsigned long)g.img[offset] << 24 | g.img[offset + 1] << 16
+        | g.img[offset + 2] << 8 | g.img[offset + 3];
+}
+
+static void put_be(unsigned long offset, unsigned long v)
+{
+    g.img[offset] = v >> 24;
+    g.img[offset + 1] = v >> 16;
+    g.img[offset + 2] = v >> 8;
+    g.img[offset + 3] = v;
+}
+
+static unsigned long skip_name(unsigned long offset)
+{
+    while(g.img[offset + 15] != '\0')
+        offset += 16;
+    return offset + 16;
+}
+
+static void checksum(unsigned long offset, unsigned long len)
+{
+    unsigned long i, sum = 0;
+
+    put_be(offset + 12, 0);
+    for(i = 0; i < len; i += 4)
+        sum += get_be(offset + i);
+    put_be(offset + 12, -sum & 0xffffffff);
+}
+
+// same hashes as __hash_char() in zromfs.c
+static void hash_char(unsigned long h[2], char c)
+{
+    h[0] = ((h[0] ^ (unsigned char)c) * 16777619UL) & 0xffffffff;
+    h[1] = (h[1] * 33 + (unsigned char)c) & 0xffffffff;
+}
+
+static void put(const unsigned long h[2], unsigned long offset,
+    unsigned long data)
+{
+    unsigned long i = h[0] % g.n, * e;
+
+    if((get_be(offset) & 7) == 0) {    // hard link, store its target
+        offset = get_be(offset + 4) & ~0xfUL;
+        data = skip_name(offset + 16);
+    }
+    while(g.slots[i * SLOT_WORDS + 2] != 0) {
+        e = &g.slots[i * SLOT_WORDS];
+        if(e[0] == h[0] && e[1] == h[1])
+            return;    // first entry wins, like the scan
+        i = (i + 1) % g.n;
+    }
+    e = &g.slots[i * SLOT_WORDS];
+    e[0] = h[0];
+    e[1] = h[1];
+    e[2] = offset;
+    e[3] = get_be(offset);
+    e[4] = get_be(offset + 4);
+    e[5] = get_be(offset + 8);
+    e[6] = data;
+    g.used++;
+}
+
+// walks a directory list like __index_dir(), count only when slots is NULL
+static void index_dir(unsigned long offset, const unsigned long h[2],
+    int root)
+{
+    while(offset != 0) {
+        unsigned long next = get_be(offset) & ~0xfUL, type = get_be(offset) & 7;
+        unsigned long ch[2] = {h[0], h[1]}, data = offset + 16;
+        const char* name = (const char*)g.img + offset + 16;
+        int i, dot;
+
+        if(offset + 32 > g.len) {
+            fprintf(stderr, "entry at 0x%lx is outside the image\n", offset);
+            exit(1);
+        }
+        if(!root)
+            hash_char(ch, '/');
+        dot = strcmp(name, ".") == 0 || strcmp(name, "..") == 0;
+        do {
+            for(i = 0; i < 16 && g.img[data + i] != '\0'; i++)
+                hash_char(ch, g.img[data + i]);
+            data += 16;
+        } while(g.img[data - 1] != '\0');
+
+        if(!dot) {
+            if(type <= 2) {    // hard link, directory, regular file
+                if(g.slots != NULL)
+                    put(ch, offset, data);
+                else
+                    g.used++;
+            }
+            if(type == 1)
+                index_dir(get_be(offset + 4) & ~0xfUL, ch, 0);
+        }
+        offset = next;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    unsigned long root, dotdot, at, data, size, i, h[2] = {2166136261UL, 5381};
+    const char* out;
+    int opt, verbose = 0;
+    FILE* f;
+    long len;
+
+    while((opt = getopt(argc, argv, "v")) != -1)
+        if(opt == 'v')
+            verbose = 1;
+    if(optind >= argc) {
+        fputs("Usage: zr_mkindex [-v] image [out_image]\n", stderr);
+        return 1;
+    }
+    out = optind + 1 < argc ? argv[optind + 1] : argv[optind];
+
+    f = fopen(argv[optind], "rb");
+    if(f == NULL) {
+        perror(argv[optind]);
+        return 1;
+    }
+    fseek(f, 0, SEEK_END);
+    len = ftell(f);
+    rewind(f);
+    g.img = calloc(1, len);
+    if(len < 512 || fread(g.img, 1, len, f) != len
+        || memcmp(g.img, "-rom1fs-", 8) != 0) {
+        fprintf(stderr, "%s: not a romfs image\n", argv[optind]);
+        return 1;
+    }
+    fclose(f);
+    g.len = get_be(8) < (unsigned long)len ? get_be(8) : len;
+
+    root = skip_name(16);
+    dotdot = get_be(root) & ~0xfUL;
+    if(dotdot == 0 || strcmp((char*)g.img + dotdot + 16, "..") != 0)
+        dotdot = root;    // no "..", link after "."
+    at = get_be(dotdot) & ~0xfUL;
+    if(at != 0 && strcmp((char*)g.img + at + 16, ".zrindex") == 0) {
+        fprintf(stderr, "%s already has a .zrindex\n", argv[optind]);
+        return 1;
+    }
+
+    // count, then size the table for at most 50% load, ".zrindex" included
+    index_dir(root, h, 1);
+    g.n = (g.used + 2) * 2;
+    g.slots = calloc(g.n, SLOT_WORDS * sizeof(unsigned long));
+    g.used = 0;
+
+    // append the file, then link it in so the walk below sees it too
+    at = (g.len + 15) & ~15UL;
+    data = at + 32;
+    size = 16 + g.n * SLOT_WORDS * 4;
+    g.len = (data + size + 1023) & ~1023UL;
+    g.img = realloc(g.img, g.len);
+    memset(g.img + at, 0, g.len - at);
+    put_be(at, (get_be(dotdot) & ~0xfUL) | 2);
+    memcpy(g.img + at + 16, ".zrindex", 8);
+    put_be(at + 8, size);
+    checksum(at, 32);
+    put_be(dotdot, at | (get_be(dotdot) & 0xf));
+    checksum(dotdot, skip_name(dotdot + 16) - dotdot);
+    put_be(8, g.len);
+
+    put(h, root, skip_name(root + 16));
+    index_dir(root, h, 1);
+    memcpy(g.img + data, "ZRIX", 4);
+    put_be(data + 4, g.n);
+    put_be(data + 8, g.len);
+    for(i = 0; i < g.n * SLOT_WORDS; i++)
+        put_be(data + 16 + i * 4, g.slots[i]);
+    checksum(0, g.len < 512 ? g.len : 512);
+
+    f = fopen(out, "wb");
+    if(f == NULL || fwrite(g.img, 1, g.len, f) != g.len || fclose(f) != 0) {
+        perror(out);
+        return 1;
+    }
+    if(verbose)
+        fprintf(stderr, "%s: %lu paths in %lu slots, %lu bytes at 0x%lx\n",
+            out, g.used, g.n, size, data);
+    return 0;
+}
@@ -0,0 +1,623 @@
+// Builds a romfs image laid out for the way zromfs reads it.
+//
+//   zr_mkromfs [-V volname] [-a align] [-l access_list] [-z block] [-p]
+//              [-u] [-v] -d dir -o image
+//
+// File data follows each header like genromfs does, unless -p packs all
+// directory lists at the front of the image: "." and "..", the
+// subdirectory headers and one 32-byte hardlink per file, so a lookup
+// walks consecutive headers instead of hopping over file data. The file
+// headers and data then follow in a data area, and readdir reports files
+// as ZR_FTYPE_HARDLINK, so it is opt-in. Files listed in the
+// access list (one image path per line, hottest first) are moved to the
+// front of their directory and of the data area. Files with identical
+// contents are stored once and hardlinked.
+//
+//   -a align  data of files up to align bytes won't cross an align
+//             boundary, larger files start on one (flash page or erase size)
+//   -p        packed directory lists, see above (-i, the default, is
+//             still accepted)
+//   -u        store duplicate files separately
+//   -z block  LZ4 compress files in blocks of this size, a power of 2 up to
+//             the reader's ZR_LZ4_BLOCK_SIZE. Files that don't shrink by
+//             1/8 are stored plain. See __z_open() in zromfs.c
+//   -v        print layout statistics to stderr
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include "../zromfs.h"
+#include "../zr_crc32.h"
+
+#define PAD16(n) (((n) + 15) & ~15UL)
+
+typedef struct node {
+    char* name;
+    char* src;                  // path on the host
+    char* path;                 // path in the image, "dir/file"
+    int type, exec, rank;
+    unsigned long size;
+    unsigned long usize;        // uncompressed size, 0 = stored plain
+    unsigned char* data;        // file contents or link target
+    zr_u32_t crc;
+    struct node* parent, * child, * next;
+    struct node* same;          // stored as a hardlink to this file
+    unsigned long entry;        // header in the parent's list
+    unsigned long list;         // directories: first entry of own list
+    unsigned long target;       // files: header followed by the data
+} node_t;
+
+static struct {
+    int inline_data, dedup, verbose;
+    unsigned long align, zblock;
+    char** hot;
+    int nhot;
+    unsigned char* img;
+    unsigned long len, cap;
+    node_t** files;
+    int nfiles, ndirs, ndups, nz;
+    unsigned long pad, saved, zsaved;
+} g = {.inline_data = 1, .dedup = 1, .align = 16};
+
+static void* xalloc(size_t n)
+{
+    void* p = calloc(1, n ? n : 1);
+    if(p == NULL) {
+        fputs("out of memory\n", stderr);
+        exit(1);
+    }
+    return p;
+}
+
+static char* xstrdup(const char* s)
+{
+    return strcpy(xalloc(strlen(s) + 1), s);
+}
+
+static unsigned long hdr_len(const char* name)
+{
+    return 16 + PAD16(strlen(name) + 1);
+}
+
+// rank of a path in the access list, lower is hotter
+static int hot_rank(const char* path)
+{
+    int i;
+    for(i = 0; i < g.nhot; i++)
+        if(strcmp(g.hot[i], path) == 0)
+            return i;
+    return INT_MAX;
+}
+
+static unsigned char* load_file(const char* fname, unsigned long size)
+{
+    unsigned char* buf = xalloc(size);
+    FILE* f = fopen(fname, "rb");
+
+    if(f == NULL || fread(buf, 1, size, f) != size) {
+        perror(fname);
+        exit(1);
+    }
+    fclose(f);
+    return buf;
+}
+
+static int cmp_node(const void* a, const void* b)
+{
+    const node_t* x = *(node_t* const*)a, * y = *(node_t* const*)b;
+    if(x->rank != y->rank)
+        return x->rank < y->rank ? -1 : 1;
+    return strcmp(x->name, y->name);
+}
+
+static node_t* scan(const char* src, const char* name, const char* path,
+    node_t* parent)
+{
+    node_t* n = xalloc(sizeof(node_t));
+    struct stat st;
+
+    if(lstat(src, &st) != 0) {
+        perror(src);
+        exit(1);
+    }
+    n->name = xstrdup(name);
+    n->src = xstrdup(src);
+    n->path = xstrdup(path);
+    n->parent = parent;
+    n->exec = (st.st_mode & S_IXUSR) != 0;
+    n->rank = hot_rank(path);
+
+    if(S_ISDIR(st.st_mode)) {
+        node_t** kids = NULL;
+        int i, cnt = 0;
+        struct dirent* de;
+        DIR* d = opendir(src);
+
+        n->type = ZR_FTYPE_DIR;
+        n->exec = 1;
+        g.ndirs++;
+        if(d == NULL) {
+            perror(src);
+            exit(1);
+        }
+        while((de = readdir(d)) != NULL) {
+            char s[PATH_MAX], p[PATH_MAX];
+            if(strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0)
+                continue;
+            kids = realloc(kids, (cnt + 1) * sizeof(node_t*));
+            snprintf(s, sizeof(s), "%s/%s", src, de->d_name);
+            snprintf(p, sizeof(p), "%s%s%s", path, *path ? "/" : "",
+                de->d_name);
+            if((kids[cnt] = scan(s, de->d_name, p, n)) != NULL)
+                cnt++;
+        }
+        closedir(d);
+        qsort(kids, cnt, sizeof(kids[0]), cmp_node);
+        for(i = cnt - 1; i >= 0; i--) {
+            kids[i]->next = n->child;
+            n->child = kids[i];
+            if(kids[i]->rank < n->rank)    // a directory is as hot as its hottest file
+                n->rank = kids[i]->rank;
+        }
+        free(kids);
+    }
+    else if(S_ISREG(st.st_mode)) {
+        n->type = ZR_FTYPE_REGULAR;
+        n->size = st.st_size;
+        n->data = load_file(src, n->size);
+        n->crc = zr_crc32(0, n->data, n->size);
+    }
+    else if(S_ISLNK(st.st_mode)) {
+        char buf[PATH_MAX];
+        ssize_t len = readlink(src, buf, sizeof(buf) - 1);
+        if(len < 0) {
+            perror(src);
+            exit(1);
+        }
+        buf[len] = '\0';
+        n->type = ZR_FTYPE_SYMBOL_LINK;
+        n->size = len;
+        n->data = (unsigned char*)xstrdup(buf);
+    }
+    else {
+        fprintf(stderr, "%s: skipped, not a file, directory or link\n", src);
+        return NULL;
+    }
+    return n;
+}
+
+// files in data area order: access list first, the rest as found
+static void collect(node_t* dir)
+{
+    node_t* n;
+    for(n = dir->child; n != NULL; n = n->next) {
+        if(n->type == ZR_FTYPE_REGULAR) {
+            g.files = realloc(g.files, (g.nfiles + 1) * sizeof(node_t*));
+            g.files[g.nfiles++] = n;
+        }
+        else if(n->type == ZR_FTYPE_DIR)
+            collect(n);
+    }
+}
+
+static int cmp_rank(const void* a, const void* b)
+{
+    const node_t* x = *(node_t* const*)a, * y = *(node_t* const*)b;
+    return x->rank < y->rank ? -1 : x->rank > y->rank;
+}
+
+static void find_dups(void)
+{
+    int i, j;
+    for(i = 0; g.dedup && i < g.nfiles; i++) {
+        node_t* f = g.files[i];
+        for(j = 0; j < i && f->size > 0; j++) {
+            node_t* o = g.files[j];
+            if(o->same == NULL && o->size == f->size && o->crc == f->crc
+                && memcmp(o->data, f->data, f->size) == 0) {
+                f->same = o;
+                g.ndups++;
+                g.saved += PAD16(f->size);
+                break;
+            }
+        }
+    }
+}
+
+#define MFLIMIT 12              // LZ4 format: no match starts in the last 12 bytes
+#define LASTLITERALS 5          // and the last 5 are literals
+
+static unsigned long lz4_len(unsigned char* dst, unsigned long op,
+    unsigned long len)
+{
+    for(len -= 15; len >= 255; len -= 255)
+        dst[op++] = 255;
+    dst[op++] = len;
+    return op;
+}
+
+static unsigned long lz4_seq(unsigned char* dst, unsigned long op,
+    const unsigned char* lit, unsigned long nlit, unsigned long dist,
+    unsigned long mlen)
+{
+    unsigned long token = op++;
+
+    dst[token] = (nlit < 15 ? nlit : 15) << 4;
+    if(nlit >= 15)
+        op = lz4_len(dst, op, nlit);
+    memcpy(dst + op, lit, nlit);
+    op += nlit;
+    if(mlen == 0)
+        return op;    // the last sequence
+    dst[token] |= mlen - 4 < 15 ? mlen - 4 : 15;
+    dst[op++] = dist;
+    dst[op++] = dist >> 8;
+    if(mlen - 4 >= 15)
+        op = lz4_len(dst, op, mlen - 4);
+    return op;
+}
+
+// greedy LZ4 block compressor, dst needs n + n / 255 + 16 bytes
+static unsigned long lz4_compress(const unsigned char* src, unsigned long n,
+    unsigned char* dst)
+{
+    static long table[4096];
+    unsigned long ip = 0, anchor = 0, op = 0, len;
+
+    memset(table, -1, sizeof(table));
+    while(n > MFLIMIT && ip < n - MFLIMIT) {
+        zr_u32_t v = src[ip] | src[ip + 1] << 8 | src[ip + 2] << 16
+            | (zr_u32_t)src[ip + 3] << 24;
+        unsigned long h = (v * 2654435761UL & 0xffffffff) >> 20;
+        long ref = table[h];
+
+        table[h] = ip;
+        if(ref < 0 || ip - ref > 65535 || memcmp(src + ref, src + ip, 4) != 0) {
+            ip++;
+            continue;
+        }
+        for(len = 4; ip + len < n - LASTLITERALS
+            && src[ref + len] == src[ip + len]; len++)
+            ;
+        op = lz4_seq(dst, op, src + anchor, ip - anchor, ip - ref, len);
+        ip += len;
+        anchor = ip;
+    }
+    return lz4_seq(dst, op, src + anchor, n - anchor, 0, 0);
+}
+
+// same decoder as __lz4_decode() in zromfs.c
+static long lz4_decode(const unsigned char* src, unsigned long slen,
+    unsigned char* dst, unsigned long dcap)
+{
+    const unsigned char* end = src + slen;
+    unsigned long op = 0, len, dist;
+
+    while(src < end) {
+        unsigned char token = *src++;
+
+        len = token >> 4;
+        if(len == 15)
+            do {
+                if(src >= end)
+                    return -1;
+                len += *src;
+            } while(*src++ == 255);
+        if(len > (unsigned long)(end - src) || len > dcap - op)
+            return -1;
+        memmove(dst + op, src, len);
+        src += len;
+        op += len;
+        if(src == end)
+            break;
+        if(end - src < 2)
+            return -1;
+        dist = src[0] | src[1] << 8;
+        src += 2;
+        len = (token & 15) + 4;
+        if((token & 15) == 15)
+            do {
+                if(src >= end)
+                    return -1;
+                len += *src;
+            } while(*src++ == 255);
+        if(dist == 0 || dist > op || len > dcap - op)
+            return -1;
+        for(; len > 0; len--, op++)
+            dst[op] = dst[op - dist];
+    }
+    return op;
+}
+
+static void be32(unsigned char* p, zr_u32_t v)
+{
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+// replace the data of a file by the block format zromfs decodes, blocks
+// that don't shrink or won't decode in place are stored raw
+static void compress(node_t* n)
+{
+    unsigned long bs = g.zblock, nb = (n->size + bs - 1) / bs, b, len, clen;
+    unsigned long out = 16 + (nb + 1) * 4, shift = 0;
+    unsigned char* z = xalloc(out + n->size + nb * (bs / 255 + 16));
+    unsigned char* tmp = xalloc(bs + bs / 255 + 16);
+    unsigned char* sim = xalloc(bs + ZR_LZ4_MARGIN);
+
+    while((1UL << shift) < bs)
+        shift++;
+    memcpy(z, "ZRLZ", 4);
+    be32(z + 4, n->size);
+    z[8] = shift;
+    be32(z + 12, nb);
+    for(b = 0; b < nb; b++) {
+        const unsigned char* src = n->data + b * bs;
+        len = b + 1 < nb ? bs : n->size - b * bs;
+        clen = lz4_compress(src, len, tmp);
+        if(clen < len) {    // decode it the way __z_load() will
+            memcpy(sim + bs + ZR_LZ4_MARGIN - clen, tmp, clen);
+            if(lz4_decode(sim + bs + ZR_LZ4_MARGIN - clen, clen, sim, len)
+                != (long)len || memcmp(sim, src, len) != 0)
+                clen = len;
+        }
+        if(clen < len) {
+            be32(z + 16 + b * 4, out);
+            memcpy(z + out, tmp, clen);
+        }
+        else {
+            be32(z + 16 + b * 4, out | 0x80000000UL);
+            memcpy(z + out, src, len);
+            clen = len;
+        }
+        out += clen;
+    }
+    be32(z + 16 + nb * 4, out);
+    free(tmp);
+    free(sim);
+
+    if(out > n->size / 8 * 7) {
+        free(z);
+        return;
+    }
+    g.nz++;
+    g.zsaved += n->size - out;
+    n->usize = n->size;
+    n->size = out;
+    free(n->data);
+    n->data = z;
+}
+
+// offset for a header whose data follows, honouring the alignment
+static unsigned long place(unsigned long* cur, const char* name,
+    unsigned long size)
+{
+    unsigned long a = g.align, h = hdr_len(name), data = *cur + h;
+
+    if(a > 16 && size > 0) {
+        if(size > a)
+            data = (data + a - 1) / a * a;
+        else if(data / a != (data + size - 1) / a)    // keep it in one page
+            data = (data + a - 1) / a * a;
+    }
+    g.pad += data - h - *cur;
+    *cur = data + PAD16(size);
+    return data - h;
+}
+
+// lists of all directories, depth first, each one packed
+static void place_lists(node_t* dir, unsigned long* cur)
+{
+    node_t* n;
+
+    dir->list = *cur;
+    *cur += hdr_len(".") + hdr_len("..");
+    for(n = dir->child; n != NULL; n = n->next) {
+        if(n->type == ZR_FTYPE_REGULAR && g.inline_data && n->same == NULL)
+            n->entry = n->target = place(cur, n->name, n->size);
+        else if(n->type == ZR_FTYPE_SYMBOL_LINK) {
+            n->entry = *cur;
+            *cur += hdr_len(n->name) + PAD16(n->size);
+        }
+        else {
+            n->entry = *cur;
+            *cur += hdr_len(n->name);
+        }
+    }
+    for(n = dir->child; n != NULL; n = n->next)
+        if(n->type == ZR_FTYPE_DIR)
+            place_lists(n, cur);
+}
+
+static void put_be(unsigned long offset, zr_u32_t v)
+{
+    g.img[offset] = v >> 24;
+    g.img[offset + 1] = v >> 16;
+    g.img[offset + 2] = v >> 8;
+    g.img[offset + 3] = v;
+}
+
+static zr_u32_t get_be(unsigned long offset)
+{
+    return (zr_u32_t)g.img[offset] << 24 | g.img[offset + 1] << 16
+        | g.img[offset + 2] << 8 | g.img[offset + 3];
+}
+
+static void checksum(unsigned long offset, unsigned long len)
+{
+    unsigned long i;
+    zr_u32_t sum = 0;
+
+    put_be(offset + 12, 0);
+    for(i = 0; i < len; i += 4)
+        sum += get_be(offset + i);
+    put_be(offset + 12, -sum);
+}
+
+static void put_hdr(unsigned long offset, unsigned long next, int type,
+    int exec, zr_u32_t spec, zr_u32_t size, const char* name,
+    const void* data, unsigned long dsize)
+{
+    unsigned long h = hdr_len(name);
+
+    put_be(offset, next | type | (exec ? 8 : 0));
+    put_be(offset + 4, spec);
+    put_be(offset + 8, size);
+    memcpy(g.img + offset + 16, name, strlen(name));
+    checksum(offset, h);
+    if(dsize > 0)
+        memcpy(g.img + offset + h, data, dsize);
+}
+
+static void write_dir(node_t* dir)
+{
+    unsigned long dot = dir->list, dotdot = dot + hdr_len(".");
+    unsigned long up = dot;
+    if(dir->parent != NULL)    // ".." points at the parent's header
+        up = dir->parent->parent ? dir->parent->entry : dir->parent->list;
+    node_t* n;
+
+    if(dir->parent == NULL)    // the root "." is the directory itself
+        put_hdr(dot, dotdot, ZR_FTYPE_DIR, 1, dot, 0, ".", NULL, 0);
+    else
+        put_hdr(dot, dotdot, ZR_FTYPE_HARDLINK, 0, dir->entry, 0, ".",
+            NULL, 0);
+    put_hdr(dotdot, dir->child ? dir->child->entry : 0, ZR_FTYPE_HARDLINK, 0,
+        up, 0, "..", NULL, 0);
+
+    for(n = dir->child; n != NULL; n = n->next) {
+        unsigned long next = n->next ? n->next->entry : 0;
+        const node_t* t = n->same ? n->same : n;
+
+        if(n->type == ZR_FTYPE_DIR) {
+            put_hdr(n->entry, next, ZR_FTYPE_DIR, 1, n->list, 0, n->name,
+                NULL, 0);
+            write_dir(n);
+        }
+        else if(n->type == ZR_FTYPE_SYMBOL_LINK)
+            put_hdr(n->entry, next, ZR_FTYPE_SYMBOL_LINK, 0, 0, n->size,
+                n->name, n->data, n->size);
+        else if(n->entry == n->target)    // inline file
+            put_hdr(n->entry, next, ZR_FTYPE_REGULAR, n->exec, n->usize,
+                n->size, n->name, n->data, n->size);
+        else {    // hardlink with the size of its target, for zr_readdir
+            put_hdr(n->entry, next, ZR_FTYPE_HARDLINK, 0, t->target,
+                t->usize ? t->usize : t->size, n->name, NULL, 0);
+            if(n->same == NULL)
+                put_hdr(n->target, 0, ZR_FTYPE_REGULAR, n->exec, n->usize,
+                    n->size, n->name, n->data, n->size);
+        }
+    }
+}
+
+static void load_list(const char* fname)
+{
+    char line[PATH_MAX];
+    FILE* f = fopen(fname, "r");
+
+    if(f == NULL) {
+        perror(fname);
+        exit(1);
+    }
+    while(fgets(line, sizeof(line), f) != NULL) {
+        char* p = line, * e;
+        while(*p == '/')
+            p++;
+        for(e = p + strlen(p); e > p && (e[-1] == '\n' || e[-1] == '\r'
+            || e[-1] == '/'); e--)
+            ;
+        *e = '\0';
+        if(*p == '\0' || *p == '#')
+            continue;
+        g.hot = realloc(g.hot, (g.nhot + 1) * sizeof(char*));
+        g.hot[g.nhot++] = xstrdup(p);
+    }
+    fclose(f);
+}
+
+int main(int argc, char* argv[])
+{
+    const char* src = NULL, * out = NULL, * vol = "zromfs";
+    unsigned long cur, meta;
+    node_t* root;
+    FILE* f;
+    int opt, i;
+
+    while((opt = getopt(argc, argv, "V:a:l:z:ipuvd:o:")) != -1) {
+        switch(opt) {
+            case 'V': vol = optarg; break;
+            case 'a': g.align = strtoul(optarg, NULL, 0); break;
+            case 'l': load_list(optarg); break;
+            case 'z': g.zblock = strtoul(optarg, NULL, 0); break;
+            case 'i': g.inline_data = 1; break;
+            case 'p': g.inline_data = 0; break;
+            case 'u': g.dedup = 0; break;
+            case 'v': g.verbose = 1; break;
+            case 'd': src = optarg; break;
+            case 'o': out = optarg; break;
+            default: src = NULL; break;
+        }
+    }
+    if(src == NULL || out == NULL || g.align < 16
+        || (g.align & (g.align - 1)) != 0 || (g.zblock != 0
+        && (g.zblock < 16 || g.zblock > 1UL << 24
+        || (g.zblock & (g.zblock - 1)) != 0))) {
+        fputs("Usage: zr_mkromfs [-V volname] [-a align] [-l access_list] "
+            "[-z block] [-p] [-u] [-v] -d dir -o image\n"
+            "       align and block are powers of 2, at least 16\n", stderr);
+        return 1;
+    }
+
+    root = scan(src, "", "", NULL);
+    if(root->type != ZR_FTYPE_DIR) {
+        fprintf(stderr, "%s is not a directory\n", src);
+        return 1;
+    }
+    collect(root);
+    find_dups();
+    for(i = 0; g.zblock && i < g.nfiles; i++)
+        if(g.files[i]->same == NULL && g.files[i]->size > 0)
+            compress(g.files[i]);
+
+    // superblock, directory lists, then the data area
+    cur = hdr_len(vol);
+    place_lists(root, &cur);
+    meta = cur;
+    if(!g.inline_data) {
+        node_t** order = xalloc(g.nfiles * sizeof(node_t*));
+        memcpy(order, g.files, g.nfiles * sizeof(node_t*));
+        qsort(order, g.nfiles, sizeof(node_t*), cmp_rank);    // hot first
+        for(i = 0; i < g.nfiles; i++)
+            if(order[i]->same == NULL)
+                order[i]->target = place(&cur, order[i]->name,
+                    order[i]->size);
+        free(order);
+    }
+    g.len = (cur + 1023) & ~1023UL;
+    g.img = xalloc(g.len);
+
+    memcpy(g.img, "-rom1fs-", 8);
+    put_be(8, g.len);
+    memcpy(g.img + 16, vol, strlen(vol));
+    write_dir(root);
+    checksum(0, g.len < 512 ? g.len : 512);
+
+    f = fopen(out, "wb");
+    if(f == NULL || fwrite(g.img, 1, g.len, f) != g.len || fclose(f) != 0) {
+        perror(out);
+        return 1;
+    }
+    if(g.verbose)
+        fprintf(stderr, "%s: %d files, %d directories, %d duplicates "
+            "(%lu bytes saved), %d compressed (%lu bytes saved), "
+            "%lu bytes of alignment padding, lists end at %lu, "
+            "image %lu bytes\n", out, g.nfiles, g.ndirs, g.ndups, g.saved,
+            g.nz, g.zsaved, g.pad, meta, g.len);
+    return 0;
+}
@@ -0,0 +1,74 @@
+// Computes the per-region CRC-32 table used by zr_fs_t verify_sums.
+//
+//   zr_mksums [-s shift] [-b] image > sums
+//
+// Regions are 1 << shift bytes (default 12, 4 KiB) starting at the
+// superblock and cover the size recorded there. The table is printed as a
+// C array, or with -b written as little-endian 32-bit words.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "../zr_crc32.h"
+
+int main(int argc, char* argv[])
+{
+    int opt, shift = 12, binary = 0;
+    unsigned char* img;
+    unsigned long size, r, n;
+    long len;
+    FILE* fp;
+
+    while((opt = getopt(argc, argv, "s:b")) != -1) {
+        if(opt == 's')
+            shift = atoi(optarg);
+        else if(opt == 'b')
+            binary = 1;
+    }
+    if(optind >= argc || shift < 4 || shift > 24) {
+        fputs("Usage: zr_mksums [-s shift] [-b] image\n", stderr);
+        return 1;
+    }
+    fp = fopen(argv[optind], "rb");
+    if(fp == NULL) {
+        perror(argv[optind]);
+        return 1;
+    }
+    fseek(fp, 0, SEEK_END);
+    len = ftell(fp);
+    rewind(fp);
+    img = malloc(len);
+    if(len < 16 || fread(img, 1, len, fp) != len
+        || memcmp(img, "-rom1fs-", 8) != 0) {
+        fprintf(stderr, "%s: not a romfs image\n", argv[optind]);
+        return 1;
+    }
+    fclose(fp);
+
+    size = (unsigned long)img[8] << 24 | img[9] << 16 | img[10] << 8 | img[11];
+    if(size > len)
+        size = len;
+    n = (size + (1UL << shift) - 1) >> shift;
+
+    if(!binary)
+        printf("// %s, %lu regions of %lu bytes, verify_shift = %d\n"
+            "const zr_u32_t zr_verify_sums[%lu] = {", argv[optind], n,
+            1UL << shift, shift, n);
+    for(r = 0; r < n; r++) {
+        unsigned long crc, end = (r + 1) << shift;
+        if(end > size)
+            end = size;
+        crc = zr_crc32(0, img + (r << shift), end - (r << shift));
+        if(binary) {
+            unsigned char le[4] = {crc, crc >> 8, crc >> 16, crc >> 24};
+            fwrite(le, 1, 4, stdout);
+        }
+        else
+            printf("%s0x%08lx,", r % 6 == 0 ? "\n    " : " ", crc);
+    }
+    if(!binary)
+        printf("\n};\n");
+    free(img);
+    return 0;
+}
@@ -0,0 +1,338 @@
+// Replays a trace of backend requests, saved by the demo_cli trace command
+// or any other zr_trace_copy() dump, and suggests a file order for it.
+//
+//   zr_trace [-c sectors] [-i] [-A align[,burst]] [-s lat_us,mb_per_s]
+//            [-p page] [-l access_list] trace source.img [target.img]
+//
+// A trace file is the records oldest first, offset and info of each one as
+// 32-bit little-endian words, see zr_trace_rec_t. source.img is the image
+// the trace was taken on: data requests are mapped back to the file they
+// served through it. The requests are reported as they were, then the
+// file reads are done again through the library on target.img (default the
+// source), under the read path set by -c, -i and -A, and reported too.
+// Lookups on the target come from opening each file at its first read, so
+// two layouts of the same tree compare on the same workload. Compressed
+// files are replayed as their stored bytes.
+//
+// Output is CSV image,origin,requests,bytes,seeks,pages,model_ms per
+// origin. Flash is split into pages (-p, default 256). A seek is a request
+// that doesn't start in the page the last one ended in or the page after
+// it, pages counts the pages each request touched, but not the one the
+// last request ended in. -s adds a cost model, lat_us per request and
+// mb_per_s per byte.
+//
+// -l writes the files in the order of their first read, one image path
+// per line, for zr_mkromfs -l: files read one after another then sit one
+// after another, and their directory entries at the front of each
+// directory, so the next replay seeks and fetches less.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "../zromfs.h"
+
+#define RING 65536
+
+typedef struct {
+    char* path;
+    zr_u32_t offset, size;      // data in the image
+    zr_u32_t first;             // first data request + 1, 0 = never read
+} file_t;
+
+typedef struct {
+    file_t* files;
+    int n, cap;
+    zr_u8_t* img;
+    zr_u32_t size;
+    zr_fs_t fs;
+} image_t;
+
+typedef struct {
+    zr_u32_t requests[ZR_IO_ORIGINS], bytes[ZR_IO_ORIGINS];
+    zr_u32_t seeks[ZR_IO_ORIGINS], pages[ZR_IO_ORIGINS];
+    zr_u32_t end;               // where the last request ended
+} report_t;
+
+static struct {
+    zr_u32_t page;
+    double lat, bw;
+    const zr_u8_t* img;         // target image for read_f
+} g = {.page = 256};
+
+static void read_f(zr_u32_t offset, void* buf, zr_u32_t size)
+{
+    memcpy(buf, g.img + offset, size);
+}
+
+static zr_u8_t* load(const char* fname, zr_u32_t* size)
+{
+    FILE* fp = fopen(fname, "rb");
+    zr_u8_t* buf;
+    long n;
+
+    if(fp == NULL) {
+        perror(fname);
+        exit(1);
+    }
+    fseek(fp, 0, SEEK_END);
+    n = ftell(fp);
+    rewind(fp);
+    buf = malloc(n ? n : 1);
+    if(buf == NULL || fread(buf, 1, n, fp) != n) {
+        fprintf(stderr, "%s: can't read\n", fname);
+        exit(1);
+    }
+    fclose(fp);
+    *size = n;
+    return buf;
+}
+
+// every regular file, hardlinks too, by full path
+static void walk(image_t* im, const char* path)
+{
+    zr_dir_t dir;
+    zr_finfo_t items[32], finfo;
+    char names[1024], * name, sub[2048];
+    zr_file_t fp;
+    int i, cnt;
+
+    if(zr_fs_opendir(&im->fs, &dir, path) != ZR_OK)
+        return;
+    while((cnt = zr_readdir_batch(&dir, items, 32, names, sizeof(names),
+        ZR_READDIR_SKIP_DOTS)) > 0) {
+        for(i = 0, name = names; i < cnt; name += strlen(name) + 1, i++) {
+            snprintf(sub, sizeof(sub), "%s/%s", path, name);
+            finfo = items[i];
+            if(finfo.ftype == ZR_FTYPE_HARDLINK
+                && zr_fs_stat(&im->fs, sub, &finfo) != ZR_OK)
+                continue;
+            if(finfo.ftype == ZR_FTYPE_DIR)
+                walk(im, sub);
+            else if(finfo.ftype == ZR_FTYPE_REGULAR
+                && zr_file_open(&im->fs, &fp, sub) == ZR_OK) {
+                if(im->n == im->cap) {
+                    im->cap = im->cap ? im->cap * 2 : 256;
+                    im->files = realloc(im->files, im->cap * sizeof(file_t));
+                }
+                im->files[im->n].path = strdup(sub);
+                im->files[im->n].offset = fp.offset;
+                im->files[im->n].size = fp.size;
+                im->files[im->n].first = 0;
+                im->n++;
+                zr_file_close(&fp);
+            }
+        }
+    }
+}
+
+static int by_offset(const void* a, const void* b)
+{
+    const file_t* x = a, * y = b;
+    return x->offset < y->offset ? -1 : x->offset > y->offset;
+}
+
+static int by_first(const void* a, const void* b)
+{
+    const file_t* x = a, * y = b;
+    return x->first < y->first ? -1 : x->first > y->first;
+}
+
+static void open_image(image_t* im, const char* fname)
+{
+    memset(im, 0, sizeof(*im));
+    im->img = load(fname, &im->size);
+    im->fs.base = im->img;
+    if(zr_fs_mount(&im->fs) != ZR_OK) {
+        fprintf(stderr, "%s: not a romfs image\n", fname);
+        exit(1);
+    }
+    walk(im, "");
+    qsort(im->files, im->n, sizeof(file_t), by_offset);
+}
+
+// the file whose data holds offset, the first path of a shared one
+static file_t* find(image_t* im, zr_u32_t offset)
+{
+    int lo = 0, hi = im->n - 1, mid = 0;
+
+    while(lo <= hi) {
+        mid = (lo + hi) / 2;
+        if(offset < im->files[mid].offset)
+            hi = mid - 1;
+        else if(mid < hi && offset >= im->files[mid + 1].offset)
+            lo = mid + 1;
+        else
+            break;
+    }
+    if(lo > hi || offset >= im->files[mid].offset + im->files[mid].size)
+        return NULL;
+    while(mid > 0 && im->files[mid - 1].offset == im->files[mid].offset)
+        mid--;
+    return &im->files[mid];
+}
+
+static void count(report_t* r, const zr_trace_rec_t* rec)
+{
+    int o = ZR_TRACE_ORIGIN(rec);
+    zr_u32_t size = ZR_TRACE_SIZE(rec), first = rec->offset / g.page;
+    zr_u32_t last = (rec->offset + (size ? size : 1) - 1) / g.page;
+    zr_u32_t prev = (r->end - 1) / g.page;    // page the last request ended in
+
+    if(o >= ZR_IO_ORIGINS)
+        return;
+    r->requests[o]++;
+    r->bytes[o] += size;
+    if(r->end == 0 || first < prev || first > prev + 1)
+        r->seeks[o]++;
+    if(r->end != 0 && first == prev)
+        first++;    // still there from the last request
+    r->pages[o] += last + 1 - first;
+    r->end = rec->offset + size;
+}
+
+static void print(const char* image, const report_t* r)
+{
+    static const char* origins[] = {"mount", "lookup", "readdir", "data",
+        "checksum"};
+    zr_u32_t t[4] = {0};
+    double ms;
+    int i;
+
+    for(i = 0; i <= ZR_IO_ORIGINS; i++) {
+        const zr_u32_t* v[4] = {r->requests, r->bytes, r->seeks, r->pages};
+        zr_u32_t c[4];
+        int k;
+        for(k = 0; k < 4; k++) {
+            c[k] = i < ZR_IO_ORIGINS ? v[k][i] : t[k];
+            t[k] += i < ZR_IO_ORIGINS ? c[k] : 0;
+        }
+        ms = (c[0] * g.lat + (g.bw > 0 ? c[1] / g.bw : 0)) * 1e3;
+        printf("%s,%s,%lu,%lu,%lu,%lu,%.3f\n", image,
+            i < ZR_IO_ORIGINS ? origins[i] : "total", (unsigned long)c[0],
+            (unsigned long)c[1], (unsigned long)c[2], (unsigned long)c[3], ms);
+    }
+}
+
+static void drain(report_t* r, zr_trace_t* tr)
+{
+    zr_trace_rec_t recs[256];
+    zr_u32_t i, n;
+
+    while((n = zr_trace_copy(tr, recs, 256)) > 0)
+        for(i = 0; i < n; i++)
+            count(r, &recs[i]);
+}
+
+int main(int argc, char* argv[])
+{
+    static zr_trace_rec_t ring[RING];
+    static zr_trace_t tr = {.recs = ring, .n = RING};
+    static image_t src, dst;
+    static char buf[1 << 16];
+    const char* list = NULL, * target;
+    zr_u32_t i, n, sectors = 0, align = 0, burst = 0, size;
+    zr_trace_rec_t* recs;
+    zr_u8_t* raw;
+    report_t r;
+    zr_file_t* fps;
+    FILE* fp;
+    int opt, indexed = 0;
+
+    while((opt = getopt(argc, argv, "c:iA:s:p:l:")) != -1) {
+        switch(opt) {
+            case 'c': sectors = atoi(optarg); break;
+            case 'i': indexed = 1; break;
+            case 'A': sscanf(optarg, "%u,%u", &align, &burst); break;
+            case 's':
+                sscanf(optarg, "%lf,%lf", &g.lat, &g.bw);
+                g.lat *= 1e-6;
+                g.bw *= 1e6;
+                break;
+            case 'p': g.page = strtoul(optarg, NULL, 0); break;
+            case 'l': list = optarg; break;
+            default: argc = 0;
+        }
+    }
+    if(argc - optind < 2 || argc - optind > 3 || g.page == 0) {
+        fputs("Usage: zr_trace [-c sectors] [-i] [-A align[,burst]] "
+            "[-s lat_us,mb_per_s] [-p page] [-l access_list] "
+            "trace source.img [target.img]\n", stderr);
+        return 1;
+    }
+    target = argc - optind == 3 ? argv[optind + 2] : argv[optind + 1];
+
+    raw = load(argv[optind], &size);
+    n = size / 8;
+    recs = malloc((n ? n : 1) * sizeof(zr_trace_rec_t));
+    for(i = 0; i < n; i++) {
+        const zr_u8_t* p = raw + i * 8;
+        recs[i].offset = p[0] | p[1] << 8 | p[2] << 16 | (zr_u32_t)p[3] << 24;
+        recs[i].info = p[4] | p[5] << 8 | p[6] << 16 | (zr_u32_t)p[7] << 24;
+    }
+    free(raw);
+
+    open_image(&src, argv[optind + 1]);
+    memset(&r, 0, sizeof(r));
+    printf("image,origin,requests,bytes,seeks,pages,model_ms\n");
+    for(i = 0; i < n; i++) {
+        file_t* f = ZR_TRACE_ORIGIN(&recs[i]) == ZR_IO_DATA
+            ? find(&src, recs[i].offset) : NULL;
+        if(f != NULL && f->first == 0)
+            f->first = i + 1;
+        count(&r, &recs[i]);
+    }
+    print(argv[optind + 1], &r);
+
+    // the same file reads through the library on the target
+    open_image(&dst, target);
+    g.img = dst.img;
+    dst.fs.base = NULL;
+    dst.fs.read_f = read_f;
+    dst.fs.io_align = align;
+    dst.fs.io_burst = burst;
+    dst.fs.io_bounce = align ? malloc(align) : NULL;
+    dst.fs.cache_size = sectors ? ZR_CACHE_BYTES(sectors) : 0;
+    dst.fs.cache_buf = sectors ? malloc(dst.fs.cache_size) : NULL;
+    dst.fs.index_size = indexed ? ZR_INDEX_BYTES(dst.n * 2 + 16) : 0;
+    dst.fs.index_buf = indexed ? malloc(dst.fs.index_size) : NULL;
+    dst.fs.trace = &tr;
+    memset(&r, 0, sizeof(r));
+    zr_fs_mount(&dst.fs);
+    drain(&r, &tr);
+    fps = calloc(src.n ? src.n : 1, sizeof(zr_file_t));
+    for(i = 0; i < n; i++) {
+        file_t* f = ZR_TRACE_ORIGIN(&recs[i]) == ZR_IO_DATA
+            ? find(&src, recs[i].offset) : NULL;
+        zr_file_t* fp = f != NULL ? &fps[f - src.files] : NULL;
+        zr_u32_t left = ZR_TRACE_SIZE(&recs[i]);
+        int got;
+
+        if(fp == NULL)
+            continue;
+        if(fp->fs == NULL && zr_file_open(&dst.fs, fp, f->path) != ZR_OK)
+            continue;
+        zr_file_lseek(fp, recs[i].offset - f->offset, 0);
+        while(left > 0 && (got = zr_file_read(fp, buf,
+            left < sizeof(buf) ? left : sizeof(buf))) > 0)
+            left -= got;
+        drain(&r, &tr);
+    }
+    print(target, &r);
+
+    if(list != NULL) {
+        if((fp = fopen(list, "w")) == NULL) {
+            perror(list);
+            return 1;
+        }
+        for(i = 1; i < src.n; i++)    // paths sharing data follow their first
+            if(src.files[i].offset == src.files[i - 1].offset)
+                src.files[i].first = src.files[i - 1].first;
+        qsort(src.files, src.n, sizeof(file_t), by_first);
+        for(i = 0; i < src.n; i++)
+            if(src.files[i].first != 0)
+                fprintf(fp, "%s\n", src.files[i].path);
+        fclose(fp);
+    }
+    return 0;
+}
@@ -0,0 +1,371 @@
+#include "zr_crc32.h"
+
+#include <stddef.h>
+
+#if ZR_CRC32_HW && (defined(__x86_64__) || defined(__i386__)) \
+    && defined(__GNUC__)
+#define ZR_CRC32_X86
+#include <immintrin.h>
+#endif
+#if ZR_CRC32_HW && defined(__aarch64__) && defined(__GNUC__)
+#define ZR_CRC32_ARM
+#include <arm_acle.h>
+#if defined(__linux__) && !defined(__ARM_FEATURE_CRC32)
+#include <sys/auxv.h>
+#define ZR_HWCAP_CRC32 (1 << 7)
+#endif
+#endif
+
+typedef zr_u32_t (*__kernel_f)(zr_u32_t crc, const zr_u8_t* p, zr_u32_t n);
+
+#if ZR_CRC32_SLICES > 0
+static zr_u32_t tab[ZR_CRC32_SLICES][256];
+#else
+static const zr_u32_t nib[16] = {    // a nibble at a time
+    0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac,
+    0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+    0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c,
+    0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c
+};
+#endif
+
+static struct {
+    __kernel_f kernel;
+    int engine;
+    int claimed;                // the first zr_crc32() is setting up
+} g;
+
+// the first zr_crc32() builds the tables and picks the engine while threads
+// getting there with it wait, without the atomics zr_crc32_select() has to
+// be called before the threads start
+#if defined(__GNUC__)
+#define __kernel_get() __atomic_load_n(&g.kernel, __ATOMIC_ACQUIRE)
+#define __kernel_set(k) __atomic_store_n(&g.kernel, k, __ATOMIC_RELEASE)
+#define __claim() (__atomic_exchange_n(&g.claimed, 1, __ATOMIC_ACQUIRE) == 0)
+#else
+#define __kernel_get() (g.kernel)
+#define __kernel_set(k) (g.kernel = (k))
+#define __claim() (g.claimed = 1)
+#endif
+
+#if ZR_CRC32_SLICES > 0
+static void __init_tables(void)
+{
+    zr_u32_t i, j, c;
+
+    for(i = 0; i < 256; i++) {
+        for(c = i, j = 0; j < 8; j++)
+            c = c & 1 ? (c >> 1) ^ 0xedb88320 : c >> 1;
+        tab[0][i] = c;
+    }
+    for(j = 1; j < ZR_CRC32_SLICES; j++)
+        for(i = 0; i < 256; i++)
+            tab[j][i] = (tab[j - 1][i] >> 8) ^ tab[0][tab[j - 1][i] & 0xff];
+}
+#endif
+
+static zr_u32_t __byte(zr_u32_t crc, const zr_u8_t* p, zr_u32_t n)
+{
+#if ZR_CRC32_SLICES > 0
+    while(n-- > 0)
+        crc = tab[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+#else
+    while(n-- > 0) {
+        crc ^= *p++;
+        crc = nib[crc & 15] ^ (crc >> 4);
+        crc = nib[crc & 15] ^ (crc >> 4);
+    }
+#endif
+    return crc;
+}
+
+#if ZR_CRC32_SLICES >= 8
+// little-endian load, the slicing kernels index bytes in stream order
+static zr_u32_t __ld32(const zr_u8_t* p)
+{
+    return p[0] | (zr_u32_t)p[1] << 8 | (zr_u32_t)p[2] << 16
+        | (zr_u32_t)p[3] << 24;
+}
+
+static zr_u32_t __slice8(zr_u32_t crc, const zr_u8_t* p, zr_u32_t n)
+{
+    for(; n >= 8; n -= 8, p += 8) {
+        zr_u32_t a = __ld32(p) ^ crc, b = __ld32(p + 4);
+        crc = tab[7][a & 0xff] ^ tab[6][(a >> 8) & 0xff]
+            ^ tab[5][(a >> 16) & 0xff] ^ tab[4][a >> 24]
+            ^ tab[3][b & 0xff] ^ tab[2][(b >> 8) & 0xff]
+            ^ tab[1][(b >> 16) & 0xff] ^ tab[0][b >> 24];
+    }
+    return __byte(crc, p, n);
+}
+#endif
+
+#if ZR_CRC32_SLICES >= 16
+static zr_u32_t __slice16(zr_u32_t crc, const zr_u8_t* p, zr_u32_t n)
+{
+    for(; n >= 16; n -= 16, p += 16) {
+        zr_u32_t a = __ld32(p) ^ crc, b = __ld32(p + 4);
+        zr_u32_t c = __ld32(p + 8), d = __ld32(p + 12);
+        crc = tab[15][a & 0xff] ^ tab[14][(a >> 8) & 0xff]
+            ^ tab[13][(a >> 16) & 0xff] ^ tab[12][a >> 24]
+            ^ tab[11][b & 0xff] ^ tab[10][(b >> 8) & 0xff]
+            ^ tab[9][(b >> 16) & 0xff] ^ tab[8][b >> 24]
+            ^ tab[7][c & 0xff] ^ tab[6][(c >> 8) & 0xff]
+            ^ tab[5][(c >> 16) & 0xff] ^ tab[4][c >> 24]
+            ^ tab[3][d & 0xff] ^ tab[2][(d >> 8) & 0xff]
+            ^ tab[1][(d >> 16) & 0xff] ^ tab[0][d >> 24];
+    }
+    return __byte(crc, p, n);
+}
+#endif
+
+static __kernel_f __sw_kernel(void)
+{
+#if ZR_CRC32_SLICES >= 16
+    return __slice16;
+#elif ZR_CRC32_SLICES >= 8
+    return __slice8;
+#else
+    return __byte;
+#endif
+}
+
+#ifdef ZR_CRC32_X86
+// carry-less multiply folding, 64 bytes per round (Intel white paper
+// "Fast CRC Computation for Generic Polynomials Using PCLMULQDQ")
+__attribute__((target("pclmul,sse4.1")))
+static zr_u32_t __pclmul(zr_u32_t crc, const zr_u8_t* p, zr_u32_t n)
+{
+    static const zr_u32_t k1k2[4] __attribute__((aligned(16))) =
+        {0x54442bd4, 0x1, 0xc6e41596, 0x1};
+    static const zr_u32_t k3k4[4] __attribute__((aligned(16))) =
+        {0x751997d0, 0x1, 0xccaa009e, 0x0};
+    static const zr_u32_t k5k0[4] __attribute__((aligned(16))) =
+        {0x63cd6124, 0x1, 0x0, 0x0};
+    static const zr_u32_t poly[4] __attribute__((aligned(16))) =
+        {0xdb710641, 0x1, 0xf7011641, 0x1};
+    __m128i x0, x1, x2, x3, x4, x5, x6, x7, x8;
+    zr_u32_t tail;
+
+    if(n < 64)
+        return __sw_kernel()(crc, p, n);
+    tail = n & 15;
+    n -= tail;
+
+    x1 = _mm_loadu_si128((const __m128i*)(p + 0x00));
+    x2 = _mm_loadu_si128((const __m128i*)(p + 0x10));
+    x3 = _mm_loadu_si128((const __m128i*)(p + 0x20));
+    x4 = _mm_loadu_si128((const __m128i*)(p + 0x30));
+    x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(crc));
+    x0 = _mm_load_si128((const __m128i*)k1k2);
+    p += 64;
+    n -= 64;
+
+    for(; n >= 64; n -= 64, p += 64) {
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+        x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+        x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+        x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+        x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x5),
+            _mm_loadu_si128((const __m128i*)(p + 0x00)));
+        x2 = _mm_xor_si128(_mm_xor_si128(x2, x6),
+            _mm_loadu_si128((const __m128i*)(p + 0x10)));
+        x3 = _mm_xor_si128(_mm_xor_si128(x3, x7),
+            _mm_loadu_si128((const __m128i*)(p + 0x20)));
+        x4 = _mm_xor_si128(_mm_xor_si128(x4, x8),
+            _mm_loadu_si128((const __m128i*)(p + 0x30)));
+    }
+
+    // fold 4 x 128 bits into 128
+    x0 = _mm_load_si128((const __m128i*)k3k4);
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+    for(; n >= 16; n -= 16, p += 16) {
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x5),
+            _mm_loadu_si128((const __m128i*)p));
+    }
+
+    // 128 -> 64 bits, then Barrett reduction to 32
+    x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+    x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+    x1 = _mm_srli_si128(x1, 8);
+    x1 = _mm_xor_si128(x1, x2);
+    x0 = _mm_loadl_epi64((const __m128i*)k5k0);
+    x2 = _mm_srli_si128(x1, 4);
+    x1 = _mm_and_si128(x1, x3);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+    x0 = _mm_load_si128((const __m128i*)poly);
+    x2 = _mm_and_si128(x1, x3);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+    x2 = _mm_and_si128(x2, x3);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+    crc = _mm_extract_epi32(x1, 1);
+
+    return __sw_kernel()(crc, p, tail);
+}
+
+static int __has_pclmul(void)
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1");
+}
+#endif
+
+#ifdef ZR_CRC32_ARM
+__attribute__((target("+crc")))
+static zr_u32_t __armv8(zr_u32_t crc, const zr_u8_t* p, zr_u32_t n)
+{
+    for(; n > 0 && ((size_t)p & 7) != 0; n--)
+        crc = __crc32b(crc, *p++);
+    for(; n >= 8; n -= 8, p += 8)
+        crc = __crc32d(crc, *(const uint64_t*)p);
+    for(; n > 0; n--)
+        crc = __crc32b(crc, *p++);
+    return crc;
+}
+
+static int __has_armv8_crc(void)
+{
+#if defined(__ARM_FEATURE_CRC32)
+    return 1;
+#elif defined(ZR_HWCAP_CRC32)
+    return (getauxval(AT_HWCAP) & ZR_HWCAP_CRC32) != 0;
+#else
+    return 0;
+#endif
+}
+#endif
+
+int zr_crc32_select(int engine)
+{
+    __kernel_f k;
+
+#if ZR_CRC32_SLICES > 0
+    if(tab[0][1] == 0)
+        __init_tables();
+#endif
+
+    if(engine == ZR_CRC32_AUTO) {
+#ifdef ZR_CRC32_X86
+        if(__has_pclmul())
+            return zr_crc32_select(ZR_CRC32_PCLMUL);
+#endif
+#ifdef ZR_CRC32_ARM
+        if(__has_armv8_crc())
+            return zr_crc32_select(ZR_CRC32_ARMV8);
+#endif
+        g.engine = ZR_CRC32_SLICES >= 16 ? ZR_CRC32_SLICE16 :
+            ZR_CRC32_SLICES >= 8 ? ZR_CRC32_SLICE8 : ZR_CRC32_BYTE;
+        __kernel_set(__sw_kernel());
+        return g.engine;
+    }
+    switch(engine) {
+        case ZR_CRC32_BYTE:
+            k = __byte;
+            break;
+#if ZR_CRC32_SLICES >= 8
+        case ZR_CRC32_SLICE8:
+            k = __slice8;
+            break;
+#endif
+#if ZR_CRC32_SLICES >= 16
+        case ZR_CRC32_SLICE16:
+            k = __slice16;
+            break;
+#endif
+#ifdef ZR_CRC32_X86
+        case ZR_CRC32_PCLMUL:
+            if(!__has_pclmul())
+                return -1;
+            k = __pclmul;
+            break;
+#endif
+#ifdef ZR_CRC32_ARM
+        case ZR_CRC32_ARMV8:
+            if(!__has_armv8_crc())
+                return -1;
+            k = __armv8;
+            break;
+#endif
+        default:
+            return -1;
+    }
+    g.engine = engine;
+    __kernel_set(k);
+    return engine;
+}
+
+static __kernel_f __first_use(void)
+{
+    __kernel_f k;
+
+    if(__claim())
+        zr_crc32_select(ZR_CRC32_AUTO);
+    while((k = __kernel_get()) == NULL)
+        ;    // another thread is building the tables
+    return k;
+}
+
+const char* zr_crc32_engine(void)
+{
+    static const char* names[] = {"auto", "byte", "slice8", "slice16",
+        "pclmul", "armv8"};
+    if(__kernel_get() == NULL)
+        __first_use();
+    return names[g.engine];
+}
+
+zr_u32_t zr_crc32(zr_u32_t crc, const void* buf, zr_u32_t size)
+{
+    __kernel_f k = __kernel_get();
+    if(k == NULL)
+        k = __first_use();
+    return ~k(~crc, buf, size);
+}
+
+static int __crc_sink(void* ctx, const void* buf, zr_u32_t size)
+{
+    *(zr_u32_t*)ctx = zr_crc32(*(zr_u32_t*)ctx, buf, size);
+    return 0;
+}
+
+ZR_RESULT zr_file_crc32(const char* path, zr_u32_t* crc)
+{
+    int n, fd = zr_open(path);
+    if(fd < 0)
+        return fd;
+
+    *crc = 0;
+    n = zr_stream(fd, 0xffffffff, __crc_sink, crc, 0);
+    zr_close(fd);
+    return n < 0 ? n : ZR_OK;
+}
+
+ZR_RESULT zr_fs_crc32(zr_fs_t* fs, const char* path, zr_u32_t* crc)
+{
+    zr_file_t f;
+    int n = zr_file_open(fs, &f, path);
+    if(n != ZR_OK)
+        return n;
+
+    *crc = 0;
+    n = zr_file_stream(&f, 0xffffffff, __crc_sink, crc, 0);    // a mapped file in one go
+    zr_file_close(&f);
+    return n < 0 ? n : ZR_OK;
+}
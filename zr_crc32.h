@@ -0,0 +1,38 @@
+#ifndef __ZR_CRC32_H
+#define __ZR_CRC32_H
+
+#include "zromfs.h"
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// configurations
+#ifndef ZR_CRC32_SLICES
+#define ZR_CRC32_SLICES 0       // 0: a 64 byte table in flash, 1, 8 or 16: tables of 1 KiB each in RAM, built at first use
+#endif
+#ifndef ZR_CRC32_HW
+#define ZR_CRC32_HW 1           // use PCLMULQDQ / ARMv8 CRC32 when the cpu has them
+#endif
+
+enum {
+    ZR_CRC32_AUTO,
+    ZR_CRC32_BYTE,
+    ZR_CRC32_SLICE8,
+    ZR_CRC32_SLICE16,
+    ZR_CRC32_PCLMUL,
+    ZR_CRC32_ARMV8
+};
+
+// CRC-32 (IEEE 802.3, same as zlib): start with crc = 0, feed the result back to continue
+zr_u32_t zr_crc32(zr_u32_t crc, const void* buf, zr_u32_t size);
+int zr_crc32_select(int engine);                            // force an engine, returns the one in use or -1, not while other threads hash
+const char* zr_crc32_engine(void);                          // name of the engine in use
+
+ZR_RESULT zr_file_crc32(const char* path, zr_u32_t* crc);   // CRC-32 of a file on the selected volume
+ZR_RESULT zr_fs_crc32(zr_fs_t* fs, const char* path, zr_u32_t* crc);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -1,4 +1,5 @@
 #include "zromfs.h"
+#include "zr_crc32.h"
 
 #include <stdio.h> // debug
 #include <string.h>
@@ -17,10 +18,16 @@ typedef struct {
     zr_u32_t checksum;
 } zr_inode_t;
 
+typedef struct {
+    zr_inode_t inode;
+    char name[16];    // first name chunk, follows the inode on disk
+} zr_dirent_t;
+
 static struct {
-    struct {
-        zr_u32_t size, curr_pos, offset;
-    } fds[ZR_MAX_OPENED_FILES + 3];     // keep 0, 1, 2
+    zr_fd_slot_t fds[ZR_MAX_OPENED_FILES];      // the built-in fd pool
+    zr_fd_slot_t* pool;
+    zr_u32_t pool_n, pool_used;
+    zr_u16_t pool_free;         // head of the free list
     struct {
         zr_fs_t* fs;
         int mounted;
@@ -28,12 +35,17 @@ static struct {
     int curr_volume, last_volume;
 } g;
 
+#if ZR_REENTRANT == 0
+#define zr_lock(fs) ((void)0)
+#define zr_unlock(fs) ((void)0)
+#endif
+
 #define _mk4(d,c,b,a) \
 ( (((zr_u32_t)(a)) << 24) | (((zr_u32_t)(b)) << 16) |\
  (((zr_u32_t)(c)) << 8) | (((zr_u32_t)(d)) ) )
 
-#define __ftype(inode) (__le(inode.next) & 0x7)
-#define __next(inode) (__le(inode.next) & (~0xf))
+#define __ftype(inode) (__le((inode).next) & 0x7)
+#define __next(inode) (__le((inode).next) & (~0xf))
 
 static zr_u32_t __le(zr_u32_t v)
 {
@@ -44,12 +56,309 @@ static zr_u32_t __le(zr_u32_t v)
 #endif
 }
 
+// compressed files keep their uncompressed size in spec
+static zr_u32_t __fsize(zr_u32_t next, zr_u32_t spec, zr_u32_t size)
+{
+#if ZR_LZ4_BLOCK_SIZE > 0
+    if((next & 0x7) == ZR_FTYPE_REGULAR && spec != 0)
+        return spec;
+#endif
+    return size;
+}
+
+static zr_u32_t __clock(zr_fs_t* fs)
+{
+    if(fs->stats == NULL || fs->stats->clock == NULL)
+        return 0;
+    return fs->stats->clock();
+}
+
+// counts one backend transaction that started at clock t0
+static void __account(zr_fs_t* fs, int origin, zr_u32_t size, zr_u32_t t0)
+{
+    zr_stats_t* st = fs->stats;
+    int b = 0;
+
+    while(b < ZR_STATS_BUCKETS - 1 && (size >> (b + 1)) != 0)
+        b++;
+    st->calls++;
+    st->bytes += size;
+    st->hist[b]++;
+    st->origin_calls[origin]++;
+    st->origin_bytes[origin] += size;
+    if(st->clock != NULL) {
+        zr_u32_t dt = st->clock() - t0;
+        st->time += dt;
+        st->origin_time[origin] += dt;
+        if(dt > st->time_max)
+            st->time_max = dt;
+    }
+}
+
+// one record per backend request, the ring overwrites its oldest
+static void __trace(zr_fs_t* fs, int origin, zr_u32_t offset, zr_u32_t size)
+{
+    zr_trace_t* tr = fs->trace;
+    zr_trace_rec_t* r;
+
+    if(tr->n == 0)
+        return;
+    r = &tr->recs[tr->head % tr->n];
+    r->offset = offset - fs->start;
+    r->info = (size < 0x0FFFFFFF ? size : 0x0FFFFFFF) << 4 | origin;
+    tr->head++;
+}
+
+static void __stats_clear(zr_stats_t* st)
+{
+    zr_u32_t (*clock)(void) = st->clock;
+    memset(st, 0, sizeof(*st));
+    st->clock = clock;
+}
+
+// one backend transaction
+static void __dev_xfer(zr_fs_t* fs, zr_u32_t offset, void* buf, zr_u32_t size,
+    int origin)
+{
+    zr_u32_t t0 = __clock(fs);
+
+    if(fs->read_f != NULL)
+        fs->read_f(offset, buf, size);
+    else {
+        zr_iovec_t iov;
+        iov.offset = offset;
+        iov.buf = buf;
+        iov.size = size;
+        fs->read_fv(fs, &iov, 1);
+    }
+    if(fs->stats != NULL)
+        __account(fs, origin, size, t0);
+    if(fs->trace != NULL)
+        __trace(fs, origin, offset, size);
+}
+
+// with io_align, every transfer is whole pages into an aligned buffer: the
+// pages in the middle go straight to buf, at most io_burst bytes at a time,
+// partial ones at the ends through io_bounce, which keeps the last such page
+// for the next read. locked: the caller holds zr_lock(fs), which guards it.
+static void __dev_split(zr_fs_t* fs, zr_u32_t offset, void* buf,
+    zr_u32_t size, int origin, int locked)
+{
+    zr_u8_t* p = buf;
+    zr_u32_t a = fs->io_align, n;
+
+    if(fs->base != NULL) {
+        memcpy(buf, (const zr_u8_t*)fs->base + offset, size);
+        return;
+    }
+    if(a <= 1) {
+        __dev_xfer(fs, offset, buf, size, origin);
+        return;
+    }
+    while(size > 0) {
+        zr_u32_t skip = offset & (a - 1), page = offset - skip;
+        zr_u32_t end = fs->start + fs->size, len = a;
+
+        if(skip == 0 && size >= a && ((uintptr_t)p % ZR_IO_MEM_ALIGN == 0
+            || fs->io_bounce == NULL)) {
+            n = size & ~(a - 1);
+            if(fs->io_burst >= a && n > fs->io_burst)
+                n = fs->io_burst & ~(a - 1);
+            __dev_xfer(fs, offset, p, n, origin);
+        }
+        else {
+            n = a - skip < size ? a - skip : size;
+            if(fs->io_bounce == NULL)
+                __dev_xfer(fs, offset, p, n, origin);
+            else {
+                if(!locked)
+                    zr_lock(fs);
+                if(fs->io_page != page + 1) {
+                    if(fs->size != 0 && end >= offset + n && page + a > end)
+                        len = end - page;    // don't read past the image
+                    __dev_xfer(fs, page, fs->io_bounce, len, origin);
+                    fs->io_page = page + 1;
+                }
+                memcpy(p, (const zr_u8_t*)fs->io_bounce + skip, n);
+                if(!locked)
+                    zr_unlock(fs);
+            }
+        }
+        p += n;
+        offset += n;
+        size -= n;
+    }
+}
+
+static void __dev_read(zr_fs_t* fs, zr_u32_t offset, void* buf, zr_u32_t size,
+    int origin)
+{
+    __dev_split(fs, offset, buf, size, origin, 0);
+}
+
+// block cache: cache_buf holds a zr_cache_t, n slot tags, then n sectors
+typedef struct {
+    zr_u32_t n, hand;
+} zr_cache_t;
+
+#define ZR_CACHE_VALID 1
+#define ZR_CACHE_REF 2
+
+static void __cache_init(zr_fs_t* fs)
+{
+    zr_cache_t* c = fs->cache_buf;
+    zr_u32_t* tags;
+    zr_u32_t i;
+
+    fs->cache_hits = fs->cache_misses = 0;
+    if(c == NULL || fs->cache_size < sizeof(zr_cache_t)) {
+        fs->cache_size = 0;
+        return;
+    }
+    tags = (zr_u32_t*)(c + 1);
+    c->n = (fs->cache_size - sizeof(zr_cache_t))
+        / (sizeof(zr_u32_t) + ZR_CACHE_SECTOR_SIZE);
+    c->hand = 0;
+    if(c->n == 0) {
+        fs->cache_size = 0;
+        return;
+    }
+    for(i = 0; i < c->n; i++)
+        tags[i] = 0;
+}
+
+static const zr_u8_t* __cache_get(zr_fs_t* fs, zr_u32_t sector, int origin)
+{
+    zr_cache_t* c = fs->cache_buf;
+    zr_u32_t* tags = (zr_u32_t*)(c + 1);
+    zr_u8_t* data = (zr_u8_t*)(tags + c->n);
+    zr_u32_t i, size;
+
+    for(i = 0; i < c->n; i++) {
+        if((tags[i] & ZR_CACHE_VALID)
+            && (tags[i] & ~(ZR_CACHE_SECTOR_SIZE - 1)) == sector) {
+            tags[i] |= ZR_CACHE_REF;
+            fs->cache_hits++;
+            return data + i * ZR_CACHE_SECTOR_SIZE;
+        }
+    }
+    fs->cache_misses++;
+
+    // CLOCK eviction: skip referenced slots once, clearing their bit
+    while(tags[c->hand] & ZR_CACHE_REF) {
+        tags[c->hand] &= ~ZR_CACHE_REF;
+        c->hand = (c->hand + 1) % c->n;
+    }
+    i = c->hand;
+    c->hand = (c->hand + 1) % c->n;
+
+    size = ZR_CACHE_SECTOR_SIZE;
+    if(fs->start + fs->size - sector < size)    // don't read past the image
+        size = fs->start + fs->size - sector;
+    __dev_split(fs, sector, data + i * ZR_CACHE_SECTOR_SIZE, size, origin, 1);
+    tags[i] = sector | ZR_CACHE_VALID | ZR_CACHE_REF;
+    return data + i * ZR_CACHE_SECTOR_SIZE;
+}
+
+static void __read(zr_fs_t* fs, zr_u32_t offset, void* buf, zr_u32_t size,
+    int origin)
+{
+    zr_u8_t* p = buf;
+
+    if(size == 0)
+        return;
+    // bulk reads bypass the cache so file data won't evict metadata
+    if(fs->base != NULL || fs->cache_size == 0
+        || size >= ZR_CACHE_SECTOR_SIZE) {
+        __dev_read(fs, offset, buf, size, origin);
+        return;
+    }
+    zr_lock(fs);
+    while(size > 0) {
+        zr_u32_t sector = offset & ~(ZR_CACHE_SECTOR_SIZE - 1);
+        zr_u32_t n = sector + ZR_CACHE_SECTOR_SIZE - offset;
+
+        if(n > size)
+            n = size;
+        memcpy(p, __cache_get(fs, sector, origin) + offset - sector, n);
+        p += n;
+        offset += n;
+        size -= n;
+    }
+    zr_unlock(fs);
+}
+
+// mapped volumes hand out a pointer into the image, others fill buf
+static const void* __fetch(zr_fs_t* fs, zr_u32_t offset, void* buf,
+    zr_u32_t size, int origin)
+{
+    if(fs->base != NULL)
+        return (const zr_u8_t*)fs->base + offset;
+    __read(fs, offset, buf, size, origin);
+    return buf;
+}
+
+// one backend transaction for several segments when possible
+static void __readv(zr_fs_t* fs, const zr_iovec_t* iov, int cnt, int origin)
+{
+    zr_u8_t bounce[64];
+    int i, j;
+
+    if(fs->base == NULL && fs->cache_size == 0 && fs->io_align <= 1
+        && fs->read_fv != NULL) {
+        zr_u32_t t0 = __clock(fs), total = 0;
+        fs->read_fv(fs, iov, cnt);
+        for(i = 0; i < cnt; i++)
+            total += iov[i].size;
+        if(fs->stats != NULL)    // one transaction of the summed size
+            __account(fs, origin, total, t0);
+        for(i = 0; fs->trace != NULL && i < cnt; i++)
+            __trace(fs, origin, iov[i].offset, iov[i].size);
+        return;
+    }
+    for(i = 0; i < cnt; i = j) {
+        zr_u32_t total = iov[i].size;
+
+        // without read_fv, contiguous small segments share one read_f call
+        for(j = i + 1; fs->base == NULL && fs->cache_size == 0 && j < cnt
+            && iov[j].offset == iov[j - 1].offset + iov[j - 1].size
+            && total + iov[j].size <= sizeof(bounce); j++)
+            total += iov[j].size;
+        if(j == i + 1)
+            __read(fs, iov[i].offset, iov[i].buf, iov[i].size, origin);
+        else {
+            zr_u8_t* p = bounce;
+            int k;
+            __read(fs, iov[i].offset, bounce, total, origin);
+            for(k = i; k < j; k++) {
+                memcpy(iov[k].buf, p, iov[k].size);
+                p += iov[k].size;
+            }
+        }
+    }
+}
+
+// inode and name into separate buffers
+static void __read_entry(zr_fs_t* fs, zr_u32_t offset, zr_inode_t* inode,
+    char* name, int origin)
+{
+    zr_iovec_t iov[2];
+
+    iov[0].offset = offset;
+    iov[0].buf = inode;
+    iov[0].size = sizeof(zr_inode_t);
+    iov[1].offset = offset + 16;
+    iov[1].buf = name;
+    iov[1].size = 16;
+    __readv(fs, iov, 2, origin);
+}
+
 static zr_u32_t __checksum(zr_fs_t* fs)
 {
     zr_u32_t buf[128];
     zr_u32_t sum = 0;
     zr_u32_t chksum_size = fs->size >= 512 ? 512 : fs->size;
-    fs->read_f(fs->start, buf, chksum_size);
+    __read(fs, fs->start, buf, chksum_size, ZR_IO_CHECKSUM);
     {
         int i;
         for(i = 0; i < chksum_size / 4; i++)
@@ -58,226 +367,1702 @@ static zr_u32_t __checksum(zr_fs_t* fs)
     return sum;
 }
 
-int zr_mount(zr_fs_t* fs)
+static void __verify_init(zr_fs_t* fs)
 {
-    if(g.last_volume >= ZR_MAX_VOLUMNS)
-        return ZR_VOLUME_NUM_EXCEED;
-    zr_super_block_t super;
+    zr_u32_t i, n;
 
-    fs->read_f(fs->start, &super, sizeof(super));
-    if(memcmp(&super, "-rom1fs-", 8) != 0)
-        return ZR_NO_FILESYSTEM;
-    fs->size = __le(super.size);
-    if(__checksum(fs) != 0)
-        return ZR_DISK_ERR;
+    fs->verify_next = 0;
+    fs->verify_failed = 0;
+    if(fs->verify_sums == NULL)
+        return;
+    n = (fs->size + (1UL << fs->verify_shift) - 1) >> fs->verify_shift;
+    for(i = 0; i < (n + 31) / 32; i++) {
+        fs->verify_map[i] = 0;
+        if(fs->verify_bad != NULL)
+            fs->verify_bad[i] = 0;
+    }
+}
 
-    g.volume[g.last_volume].fs = fs;
-    g.volume[g.last_volume].mounted = 1;
+#define __verified(fs, r) ((fs)->verify_map[(r) / 32] & (1UL << ((r) % 32)))
+#define __verify_bad(fs, r) ((fs)->verify_bad != NULL \
+    && ((fs)->verify_bad[(r) / 32] & (1UL << ((r) % 32))))
 
-    int ret = g.last_volume;
-    g.last_volume++;
-    return ret;
+static ZR_RESULT __verify_region(zr_fs_t* fs, zr_u32_t r)
+{
+    zr_u8_t buf[128];
+    zr_u32_t crc = 0;
+    zr_u32_t offset = fs->start + (r << fs->verify_shift);
+    zr_u32_t end = offset + (1UL << fs->verify_shift);
+
+    if(end > fs->start + fs->size)
+        end = fs->start + fs->size;
+    if(fs->base != NULL)    // whole region in one pass
+        crc = zr_crc32(0, (const zr_u8_t*)fs->base + offset, end - offset);
+    while(fs->base == NULL && offset < end) {
+        zr_u32_t n = end - offset < sizeof(buf) ? end - offset : sizeof(buf);
+        __dev_read(fs, offset, buf, n, ZR_IO_CHECKSUM);
+        crc = zr_crc32(crc, buf, n);
+        offset += n;
+    }
+    zr_lock(fs);
+    // a failed region is checked once and counted once, except in strict
+    // mode with nowhere to remember it, where each read has to check again
+    if(crc != fs->verify_sums[r] && !__verified(fs, r)) {
+        fs->verify_failed++;
+        if(fs->verify_bad != NULL)
+            fs->verify_bad[r / 32] |= 1UL << (r % 32);
+    }
+    if(crc == fs->verify_sums[r] || fs->verify_bad != NULL
+        || !(fs->verify_flags & ZR_VERIFY_STRICT))
+        fs->verify_map[r / 32] |= 1UL << (r % 32);
+    zr_unlock(fs);
+    return crc == fs->verify_sums[r] ? ZR_OK : ZR_DISK_ERR;
+}
+
+// lazy verification of the regions a data read is about to touch
+static ZR_RESULT __verify_range(zr_fs_t* fs, zr_u32_t offset, zr_u32_t size)
+{
+    zr_u32_t r, last;
+
+    if(fs->verify_sums == NULL || !(fs->verify_flags & ZR_VERIFY_ON_READ)
+        || size == 0)
+        return ZR_OK;
+    r = (offset - fs->start) >> fs->verify_shift;
+    last = (offset + size - 1 - fs->start) >> fs->verify_shift;
+    for(; r <= last; r++) {
+        if((__verified(fs, r) ? __verify_bad(fs, r)
+            : __verify_region(fs, r) != ZR_OK)
+            && (fs->verify_flags & ZR_VERIFY_STRICT))
+            return ZR_DISK_ERR;
+    }
+    return ZR_OK;
+}
+
+int zr_verify_step(zr_fs_t* fs, zr_u32_t budget)
+{
+    zr_u32_t r, left = 0, done = 0, size = 1UL << fs->verify_shift;
+    zr_u32_t n = (fs->size + size - 1) >> fs->verify_shift;
+
+    if(fs->verify_sums == NULL)
+        return 0;
+    for(; fs->verify_next < n; fs->verify_next++) {
+        if(__verified(fs, fs->verify_next))
+            continue;
+        if(done > 0 && done + size > budget)
+            break;
+        if(__verify_region(fs, fs->verify_next) != ZR_OK)
+            return ZR_DISK_ERR;    // the next call goes on past it once recorded
+        done += size;
+    }
+    for(r = fs->verify_next; r < n; r++)
+        left += !__verified(fs, r);
+    return left;
+}
+
+// 1 if size bytes at offset are all in the image
+static int __in_image(const zr_fs_t* fs, zr_u32_t offset, zr_u32_t size)
+{
+    zr_u32_t rel = offset - fs->start;
+    return rel <= fs->size && fs->size - rel >= size;
 }
 
-static zr_u32_t __skip_name(zr_u32_t offset)
+// a name running off the image ends there
+static zr_u32_t __skip_name(zr_fs_t* fs, zr_u32_t offset, int origin)
 {
     char buf[16];
-    zr_fs_t* fs = g.volume[g.curr_volume].fs;
+    const char* name;
     do {
-        fs->read_f(offset, buf, 16);
+        if(!__in_image(fs, offset, 16))
+            break;
+        name = __fetch(fs, offset, buf, 16, origin);
         offset += 16;
-    } while(buf[15] != '\0');
+    } while(name[15] != '\0');
     return offset;
 }
 
-static zr_s32_t __seek_fname(zr_u32_t offset, const char* path)
+static void __fsck_bad(zr_fsck_t* r, zr_u32_t offset, int error)
+{
+    if(r->errors++ == 0) {
+        r->bad = offset;
+        r->error = error;
+    }
+}
+
+// 1 if the header at offset was seen before, marks it
+static int __fsck_seen(zr_fs_t* fs, zr_fsck_t* r, zr_u32_t offset)
+{
+    zr_u32_t b = (offset - fs->start) / 16, m = 1UL << (b % 32);
+
+    if(r->map == NULL || b / 32 >= r->map_size / 4)
+        return 0;
+    if(r->map[b / 32] & m)
+        return 1;
+    r->map[b / 32] |= m;
+    return 0;
+}
+
+// bounds and checksum of the header and name at offset, the inode and the
+// first name chunk out, returns the data offset, 0 if it is bad
+static zr_u32_t __fsck_hdr(zr_fs_t* fs, zr_fsck_t* r, zr_u32_t offset,
+    zr_dirent_t* ent)
+{
+    zr_u32_t buf[8], sum = 0, p = offset + 32;
+    const zr_u32_t* w;
+    int i;
+
+    if((offset & 0xf) != 0 || !__in_image(fs, offset, 32)) {
+        __fsck_bad(r, offset, ZR_FSCK_BOUNDS);
+        return 0;
+    }
+    w = __fetch(fs, offset, buf, 32, ZR_IO_CHECKSUM);
+    memcpy(ent, w, sizeof(*ent));
+    for(i = 0; i < 8; i++)
+        sum += __le(w[i]);
+    while(((const char*)w)[i * 4 - 1] != '\0') {    // last byte of the chunk
+        if(!__in_image(fs, p, 16)) {
+            __fsck_bad(r, offset, ZR_FSCK_BOUNDS);
+            return 0;
+        }
+        w = __fetch(fs, p, buf, 16, ZR_IO_CHECKSUM);
+        for(i = 0; i < 4; i++)
+            sum += __le(w[i]);
+        p += 16;
+    }
+    if(sum != 0) {
+        __fsck_bad(r, offset, ZR_FSCK_CHECKSUM);
+        return 0;
+    }
+    return p;
+}
+
+static void __fsck_file(zr_fs_t* fs, zr_fsck_t* r, zr_u32_t offset,
+    zr_u32_t data, zr_u32_t size, int flags)
+{
+    zr_u8_t buf[128];
+    zr_u32_t crc = 0;
+
+    if(!__in_image(fs, data, size)) {
+        __fsck_bad(r, offset, ZR_FSCK_BOUNDS);
+        return;
+    }
+    r->files++;
+    r->bytes += size;
+    if(!(flags & ZR_FSCK_DATA))
+        return;
+    if(fs->base != NULL)
+        crc = zr_crc32(0, (const zr_u8_t*)fs->base + data, size);
+    while(fs->base == NULL && size > 0) {
+        zr_u32_t n = size < sizeof(buf) ? size : sizeof(buf);
+        __dev_read(fs, data, buf, n, ZR_IO_CHECKSUM);
+        crc = zr_crc32(crc, buf, n);
+        data += n;
+        size -= n;
+    }
+    r->data_sum += crc;
+}
+
+// every header of the list at offset and, unless shallow, the lists below
+static void __fsck_list(zr_fs_t* fs, zr_fsck_t* r, zr_u32_t offset,
+    int flags, int depth)
+{
+    zr_u32_t n = 0;
+
+    if(depth > ZR_MAX_DEPTH) {
+        __fsck_bad(r, offset, ZR_FSCK_CYCLE);
+        return;
+    }
+    while(offset != 0) {
+        zr_dirent_t ent, tgt;
+        zr_u32_t data, spec, size, tdata;
+        int dot;
+
+        if(n++ > fs->size / 32 || __fsck_seen(fs, r, offset)) {
+            __fsck_bad(r, offset, ZR_FSCK_CYCLE);
+            return;
+        }
+        if((data = __fsck_hdr(fs, r, offset, &ent)) == 0)
+            return;    // next can't be trusted either
+        r->headers++;
+        spec = __le(ent.inode.spec);
+        size = __le(ent.inode.size);
+        dot = ent.name[0] == '.' && (ent.name[1] == '\0'
+            || (ent.name[1] == '.' && ent.name[2] == '\0'));
+        switch(__ftype(ent.inode)) {
+            case ZR_FTYPE_HARDLINK:
+                if((spec & 0xf) != 0 || !__in_image(fs, spec, 32)) {
+                    __fsck_bad(r, offset, ZR_FSCK_BOUNDS);
+                    break;
+                }
+                if((tdata = __fsck_hdr(fs, r, spec, &tgt)) == 0)
+                    break;
+                if(__ftype(tgt.inode) == ZR_FTYPE_HARDLINK
+                    || (dot && __ftype(tgt.inode) != ZR_FTYPE_DIR))
+                    __fsck_bad(r, offset, ZR_FSCK_TYPE);
+                else if(__ftype(tgt.inode) == ZR_FTYPE_REGULAR)
+                    __fsck_file(fs, r, spec, tdata, __le(tgt.inode.size),
+                        flags);
+                break;
+            case ZR_FTYPE_DIR:
+                if(dot)
+                    break;
+                r->dirs++;
+                if((spec & ~0xf) == 0)
+                    __fsck_bad(r, offset, ZR_FSCK_TYPE);
+                else if(!(flags & ZR_FSCK_SHALLOW))
+                    __fsck_list(fs, r, spec & ~0xf, flags, depth + 1);
+                break;
+            case ZR_FTYPE_REGULAR:
+                __fsck_file(fs, r, offset, data, size, flags);
+                break;
+            case ZR_FTYPE_SYMBOL_LINK:
+                if(!__in_image(fs, data, size))
+                    __fsck_bad(r, offset, ZR_FSCK_BOUNDS);
+                break;
+        }
+        offset = __next(ent.inode);
+    }
+}
+
+ZR_RESULT zr_fsck(zr_fs_t* fs, const char* path, int flags, zr_fsck_t* r)
+{
+    zr_dir_t dir;
+    zr_u32_t i;
+
+    r->headers = r->dirs = r->files = r->bytes = r->data_sum = 0;
+    r->errors = r->bad = 0;
+    r->error = ZR_FSCK_OK;
+    for(i = 0; r->map != NULL && i < r->map_size / 4; i++)
+        r->map[i] = 0;
+    if(__checksum(fs) != 0)
+        __fsck_bad(r, fs->start, ZR_FSCK_CHECKSUM);
+    if(zr_fs_opendir(fs, &dir, path) != ZR_OK)
+        return ZR_DIR_NOT_FOUND;
+    __fsck_list(fs, r, dir.offset, flags, 0);
+    return r->errors == 0 ? ZR_OK : ZR_DISK_ERR;
+}
+
+// compares the name whose first chunk is at data, 16 bytes at a time, with
+// the first component of path, returns its length if they match, else -1
+static int __match_name(zr_fs_t* fs, const char* name, zr_u32_t data,
+    const char* path)
+{
+    char nbuf[16];
+    int i, len = 0;
+
+    while(1) {
+        for(i = 0; i < 16; i++, len++) {
+            char c = path[len] == '/' ? '\0' : path[len];
+            if(name[i] != c)
+                return -1;
+            if(c == '\0')
+                return len;
+        }
+        data += 16;    // 16 equal chars, the name goes on in the next chunk
+        if(!__in_image(fs, data, 16))
+            return -1;
+        name = __fetch(fs, data, nbuf, 16, ZR_IO_LOOKUP);
+    }
+}
+
+// a list can't hold more headers than fit in the image, a longer one is a
+// cycle, so is a header outside it
+static zr_s32_t __seek_fname(zr_fs_t* fs, zr_u32_t offset, const char* path)
 {
-    zr_fs_t* fs = g.volume[g.curr_volume].fs;
+    zr_u32_t n = 0;
+
     while(path[0] == '/')
         path++;
     if(strlen(path) == 0)
         return offset;
 
     while(1) {
-        zr_inode_t inode;
-        char fname[16];
-
-        fs->read_f(offset, &inode, sizeof(inode));
-        fs->read_f(offset + 16, fname, sizeof(fname));    // fname, only 16 chars available
-        if(strcmp(path, fname) == 0) {    // path found
-            if(__ftype(inode) == ZR_FTYPE_REGULAR
-                || __ftype(inode) == ZR_FTYPE_DIR)
+        zr_dirent_t ebuf;
+        const zr_dirent_t* ent;
+        const zr_inode_t* inode;
+        int len;
+
+        if(!__in_image(fs, offset, sizeof(ebuf)) || n++ > fs->size / 32)
+            return ZR_DISK_ERR;
+        ent = __fetch(fs, offset, &ebuf, sizeof(ebuf), ZR_IO_LOOKUP);
+        inode = &ent->inode;
+        len = __match_name(fs, ent->name, offset + 16, path);
+        if(len >= 0 && path[len] == '\0') {    // path found
+            if(__ftype(*inode) == ZR_FTYPE_REGULAR
+                || __ftype(*inode) == ZR_FTYPE_DIR)
                 return offset;
-            else if(__ftype(inode) == ZR_FTYPE_HARDLINK) {
-                return __le(inode.spec);
+            else if(__ftype(*inode) == ZR_FTYPE_HARDLINK) {
+                return __le(inode->spec);
             }
             else
                 return ZR_FILETYPE_NOT_SUPPORTED;
         }
-        if(strstr(path, fname) == path && path[strlen(fname)] == '/') {
+        if(len >= 0) {    // followed by '/'
 
-            if(__ftype(inode) == ZR_FTYPE_HARDLINK) {    //hard link to . or ..
+            if(__ftype(*inode) == ZR_FTYPE_HARDLINK) {    //hard link to . or ..
                 return ZR_FILETYPE_NOT_SUPPORTED;
             }
-            else if(__ftype(inode) == ZR_FTYPE_DIR) {    //directory
-                zr_inode_t t;
-
-                fs->read_f(offset, &t, sizeof(t));
-                fs->read_f(offset + 16, fname, sizeof(fname));    // fname, only 16 chars available
-                offset = __seek_fname(__le(t.spec) & ~0xf,
-                    path + strlen(fname) + 1);
-                if(offset > 0)
-                    return offset;
+            else if(__ftype(*inode) == ZR_FTYPE_DIR) {    //directory
+                zr_s32_t found = __seek_fname(fs, __le(inode->spec) & ~0xf,
+                    path + len + 1);
+                if(found > 0)
+                    return found;
             }
-            else if(__ftype(inode) == ZR_FTYPE_SYMBOL_LINK) {    //symbolic link to a directory
+            else if(__ftype(*inode) == ZR_FTYPE_SYMBOL_LINK) {    //symbolic link to a directory
                 return ZR_FILETYPE_NOT_SUPPORTED;
             }
         }
-        offset = __le(inode.next);
+        offset = __le(inode->next);
         offset &= ~0xf;
         if(offset == 0)
             return ZR_FILE_NOT_FOUND;    // not found
     }
 }
 
-ZR_RESULT zr_select_volume(int volume_id)
+// path index: index_buf holds a zr_index_t followed by n hash slots
+typedef struct {
+    zr_u32_t n, used, complete;
+} zr_index_t;
+
+typedef struct {
+    zr_u32_t hash, check;       // two independent hashes of the full path
+    zr_u32_t offset;            // inode offset, hard links resolved, 0 = empty slot
+    zr_u32_t next, spec, size;  // inode fields in host order
+    zr_u32_t data;              // file data offset
+} zr_index_ent_t;
+
+static void __hash_char(zr_u32_t h[2], char c)
 {
-    if(g.volume[volume_id].mounted == 1) {
-        g.curr_volume = volume_id;
-        return ZR_OK;
+    h[0] = (h[0] ^ (zr_u8_t)c) * 16777619UL;    // FNV-1a
+    h[1] = h[1] * 33 + (zr_u8_t)c;              // djb2
+}
+
+// hash a path the way the index stores it: "dir/sub/file", no extra slashes
+static int __path_hash(const char* path, zr_u32_t h[2])
+{
+    int first = 1;
+
+    h[0] = 2166136261UL;
+    h[1] = 5381;
+    while(1) {
+        int len = 0;
+        while(*path == '/')
+            path++;
+        while(path[len] != '/' && path[len] != '\0')
+            len++;
+        if(len == 0)
+            return ZR_OK;
+        if(path[0] == '.' && (len == 1 || (len == 2 && path[1] == '.')))
+            return ZR_FILETYPE_NOT_SUPPORTED;    // . and .. are left to the scan
+        if(!first)
+            __hash_char(h, '/');
+        first = 0;
+        while(len-- > 0)
+            __hash_char(h, *path++);
     }
-    else
-        return ZR_VOLUME_NOT_MOUNTED;
 }
 
-int zr_opendir(zr_dir_t* dir, const char* path)
+// Bloom filter bits of a path, double hashing over the index hashes
+static void __bloom_bit(const zr_fs_t* fs, const zr_u32_t h[2], int i,
+    zr_u32_t* word, zr_u32_t* mask)
 {
-    zr_s32_t offset;
-    zr_inode_t inode;
-    zr_fs_t* fs = g.volume[g.curr_volume].fs;
+    zr_u32_t bit = (h[0] + i * (h[1] | 1)) % (fs->bloom_size / 4 * 32);
 
-    dir->offset = fs->start + 16;
-    dir->offset = __skip_name(dir->offset);
-    offset = __seek_fname(dir->offset, path);
-    if(offset == -1)
-        return ZR_DIR_NOT_FOUND;
-    fs->read_f(offset, &inode, sizeof(inode));
+    *word = bit / 32;
+    *mask = 1UL << (bit % 32);
+}
 
-    if((__le(inode.next) & 0x7) != ZR_FTYPE_DIR)
-        return ZR_NOT_A_DIR;
+static void __bloom_add(zr_fs_t* fs, const zr_u32_t h[2])
+{
+    zr_u32_t* bits = fs->bloom_buf, w, m;
+    int i;
 
-    dir->offset = __le(inode.spec);    //offset;
-    return ZR_OK;
+    for(i = 0; i < ZR_BLOOM_HASHES; i++) {
+        __bloom_bit(fs, h, i, &w, &m);
+        bits[w] |= m;
+    }
 }
 
-int zr_stat(const char* path, zr_finfo_t* finfo)
+// 0 if the path is surely not on the volume
+static int __bloom_has(const zr_fs_t* fs, const zr_u32_t h[2])
 {
-    zr_inode_t inode;
+    const zr_u32_t* bits = fs->bloom_buf;
+    zr_u32_t w, m;
+    int i;
 
-    zr_fs_t* fs = g.volume[g.curr_volume].fs;
-    zr_s32_t offset = fs->start + 16;
-    offset = __skip_name(offset);
-    offset = __seek_fname(offset, path);
-    if(offset < 0)
-        return ZR_FILE_NOT_FOUND;
-    fs->read_f(offset, &inode, sizeof(inode));
-    fs->read_f(offset + 16, finfo->fname, sizeof(finfo->fname));
+    for(i = 0; i < ZR_BLOOM_HASHES; i++) {
+        __bloom_bit(fs, h, i, &w, &m);
+        if((bits[w] & m) == 0)
+            return 0;
+    }
+    return 1;
+}
 
-    finfo->fsize = __le(inode.size);
-    finfo->spec = __le(inode.spec);
-    finfo->offset = offset;
-    finfo->next = __le(inode.next) & (~0xf);
-    finfo->ftype = __le(inode.next) & 0x7;
+static void __index_put(zr_fs_t* fs, const zr_u32_t h[2], zr_u32_t offset,
+    zr_u32_t data)
+{
+    zr_index_t* idx = fs->index_buf;
+    zr_index_ent_t* ents = (zr_index_ent_t*)(idx + 1);
+    zr_index_ent_t* e;
+    zr_inode_t ibuf;
+    const zr_inode_t* inode;
+    zr_u32_t i;
 
-    return ZR_OK;
+    if(fs->bloom_size != 0)
+        __bloom_add(fs, h);
+    if(fs->index_size == 0)
+        return;
+    i = h[0] % idx->n;
+    if(idx->used * 4 >= idx->n * 3) {    // keep probe chains short
+        idx->complete = 0;
+        return;
+    }
+    inode = __fetch(fs, offset, &ibuf, sizeof(ibuf), ZR_IO_MOUNT);
+    if(__ftype(*inode) == ZR_FTYPE_HARDLINK) {
+        offset = __le(inode->spec) & ~0xf;
+        if(!__in_image(fs, offset, 32)) {    // leave it to the scan
+            idx->complete = 0;
+            return;
+        }
+        inode = __fetch(fs, offset, &ibuf, sizeof(ibuf), ZR_IO_MOUNT);
+        data = __skip_name(fs, offset + 16, ZR_IO_MOUNT);
+    }
+    while(ents[i].offset != 0) {
+        if(ents[i].hash == h[0] && ents[i].check == h[1])
+            return;    // first entry wins, like the scan
+        i = (i + 1) % idx->n;
+    }
+    e = &ents[i];
+    e->hash = h[0];
+    e->check = h[1];
+    e->offset = offset;
+    e->next = __le(inode->next);
+    e->spec = __le(inode->spec);
+    e->size = __le(inode->size);
+    e->data = data;
+    idx->used++;
 }
 
-int zr_readdir(zr_dir_t* dir, zr_finfo_t* finfo)
+// a damaged tree can't be walked to the end: the index can no longer say
+// a path is missing, and neither can the filter with all bits set
+static void __index_abort(zr_fs_t* fs)
 {
-    zr_inode_t inode;
-    zr_fs_t* fs = g.volume[g.curr_volume].fs;
+    if(fs->index_size != 0)
+        ((zr_index_t*)fs->index_buf)->complete = 0;
+    if(fs->bloom_size != 0)
+        memset(fs->bloom_buf, 0xFF, fs->bloom_size);
+}
 
-    if(dir->offset == fs->start)
-        return ZR_NO_FILE;
-    fs->read_f(dir->offset, &inode, sizeof(inode));
-    fs->read_f(dir->offset + 16, finfo->fname, sizeof(finfo->fname));
+// left: headers the walk may still visit, more than fit in the image is a
+// cycle
+static int __index_dir(zr_fs_t* fs, zr_u32_t offset, const zr_u32_t h[2],
+    int depth, zr_u32_t* left)
+{
+    if(depth > ZR_MAX_DEPTH)
+        return -1;
+    while(offset != 0) {
+        zr_dirent_t ebuf;
+        char nbuf[16];
+        const zr_dirent_t* ent;
+        const zr_inode_t* inode;
+        const char* name;
+        zr_u32_t ch[2], data = offset + 16, next;
+        int i, dot = 0;
 
-    finfo->fsize = __le(inode.size);
-    finfo->spec = __le(inode.spec);
-    finfo->offset = dir->offset;
-    finfo->next = __le(inode.next) & (~0xf);
-    finfo->ftype = __le(inode.next) & 0x7;
-    dir->offset = __le(inode.next) & (~0xf);
+        if(!__in_image(fs, offset, sizeof(ebuf)) || (*left)-- == 0)
+            return -1;
+        ent = __fetch(fs, offset, &ebuf, sizeof(ebuf), ZR_IO_MOUNT);
+        inode = &ent->inode;
+        name = ent->name;
+        next = __next(*inode);
+        ch[0] = h[0];
+        ch[1] = h[1];
+        if(depth > 0)
+            __hash_char(ch, '/');
+        dot = name[0] == '.'
+            && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'));
+        while(1) {
+            for(i = 0; i < 16 && name[i] != '\0'; i++)
+                __hash_char(ch, name[i]);
+            data += 16;
+            if(name[15] == '\0')
+                break;
+            if(!__in_image(fs, data, 16))
+                return -1;
+            name = __fetch(fs, data, nbuf, 16, ZR_IO_MOUNT);
+        }
 
-    return ZR_OK;
+        if(!dot) {
+            if(__ftype(*inode) == ZR_FTYPE_REGULAR
+                || __ftype(*inode) == ZR_FTYPE_DIR
+                || __ftype(*inode) == ZR_FTYPE_HARDLINK)
+                __index_put(fs, ch, offset, data);
+            if(__ftype(*inode) == ZR_FTYPE_DIR && __index_dir(fs,
+                __le(inode->spec) & ~0xf, ch, depth + 1, left) != 0)
+                return -1;
+        }
+        offset = next;
+    }
+    return 0;
 }
 
-static int __find_free_fd(void)
+// one walk of the tree fills the RAM index and the Bloom filter
+static void __index_build(zr_fs_t* fs)
 {
-    int i;
-    for(i = 3; i < ZR_MAX_OPENED_FILES + 3; i++) {
-        if(g.fds[i].offset == 0)
-            return i;
+    zr_index_t* idx = fs->index_buf;
+    zr_index_ent_t* ents;
+    zr_u32_t h[2], i, root, left;
+
+    if(idx == NULL || fs->index_size < ZR_INDEX_BYTES(1))
+        fs->index_size = 0;
+    if(fs->bloom_buf == NULL || fs->bloom_size < 4)
+        fs->bloom_size = 0;
+    if(fs->index_size == 0 && fs->bloom_size == 0)
+        return;
+    if(fs->index_size != 0) {
+        ents = (zr_index_ent_t*)(idx + 1);
+        idx->n = (fs->index_size - sizeof(zr_index_t))
+            / sizeof(zr_index_ent_t);
+        idx->used = 0;
+        idx->complete = 1;
+        for(i = 0; i < idx->n; i++)
+            ents[i].offset = 0;
+    }
+    if(fs->bloom_size != 0)
+        memset(fs->bloom_buf, 0, fs->bloom_size);
+
+    root = __skip_name(fs, fs->start + 16, ZR_IO_MOUNT);
+    left = fs->size / 32;
+    __path_hash("", h);
+    if(!__in_image(fs, root, 32)) {
+        __index_abort(fs);
+        return;
     }
-    return ZR_OPENED_FILE_EXCEED;
+    __index_put(fs, h, root, __skip_name(fs, root + 16, ZR_IO_MOUNT));
+    if(__index_dir(fs, root, h, 0, &left) != 0)
+        __index_abort(fs);
 }
 
-int zr_open(const char* path)
+// on-image index written by tools/zr_mkindex: a ".zrindex" file linked
+// right after the root's "..", holding "ZRIX", the slot count, the image
+// size it was made for, a reserved word, then big-endian zr_index_ent_t slots
+static void __img_index_init(zr_fs_t* fs)
 {
-    int fd;
-    zr_finfo_t finfo;
-    int ret = zr_stat(path, &finfo);
-    if(ret != ZR_OK)
-        return ret;
+    zr_u32_t offset = __skip_name(fs, fs->start + 16, ZR_IO_MOUNT);
+    int i;
 
-    fd = __find_free_fd();
-    if(fd < 0)
-        return fd;
-    g.fds[fd].size = finfo.fsize;
-    g.fds[fd].offset = finfo.offset + 16;
-    g.fds[fd].offset = __skip_name(g.fds[fd].offset);
-    g.fds[fd].curr_pos = 0;
-    return fd;    //skips system FDs
+    fs->img_index = fs->img_index_n = 0;
+    for(i = 0; i < 3 && offset != 0; i++) {    // ".", "..", ".zrindex"
+        zr_dirent_t ebuf;
+        zr_u32_t hbuf[4];
+        const zr_u32_t* hdr;
+        const zr_dirent_t* ent;
+
+        if(!__in_image(fs, offset, sizeof(ebuf)))
+            return;
+        ent = __fetch(fs, offset, &ebuf, sizeof(ebuf), ZR_IO_MOUNT);
+        if(__ftype(ent->inode) == ZR_FTYPE_REGULAR
+            && memcmp(ent->name, ".zrindex", 9) == 0) {
+            zr_u32_t size = __le(ent->inode.size);
+            // the whole table in the image, or no index at all
+            if(size < sizeof(hbuf) || !__in_image(fs, offset + 32, size))
+                return;
+            hdr = __fetch(fs, offset + 32, hbuf, sizeof(hbuf), ZR_IO_MOUNT);
+            if(memcmp(hdr, "ZRIX", 4) == 0 && __le(hdr[2]) == fs->size
+                && __le(hdr[1]) > 0
+                && (size - sizeof(hbuf)) / sizeof(zr_index_ent_t)
+                >= __le(hdr[1])) {
+                fs->img_index = offset + 32 + sizeof(hbuf);
+                fs->img_index_n = __le(hdr[1]);
+            }
+            return;
+        }
+        offset = __next(ent->inode);
+    }
 }
 
-int zr_close(int fd)
+// 1 if the headers and data a slot points at are in the image
+static int __img_slot_ok(zr_fs_t* fs, const zr_index_ent_t* e)
 {
-//    zr_fs_t* fs = g.volume[g.curr_volume].fs;
-    if(g.fds[fd].offset == 0)
-        return ZR_FILE_NOT_OPENED;
-    g.fds[fd].curr_pos = 0;
-    g.fds[fd].offset = 0;
-    return ZR_OK;
+    if((e->offset & 0xf) != 0 || !__in_image(fs, e->offset, 32)
+        || e->data < e->offset + 32 || !__in_image(fs, e->data, 0))
+        return 0;
+    if((e->next & 0x7) == ZR_FTYPE_DIR)
+        return __in_image(fs, e->spec & ~0xf, 32);
+    if((e->next & 0x7) == ZR_FTYPE_REGULAR)
+        return __in_image(fs, e->data, e->size);    // stored bytes, also when compressed
+    return 1;
 }
 
-int zr_read(int fd, void* buf, zr_u32_t nbytes)
+// two slots per read, so most lookups cost one transaction, a slot pointing
+// out of the image leaves the lookup to the scan
+static int __img_index_find(zr_fs_t* fs, const zr_u32_t h[2],
+    zr_index_ent_t* ent)
 {
-    int max_to_read;
-    zr_fs_t* fs = g.volume[g.curr_volume].fs;
-    if(g.fds[fd].offset == 0)
-        return ZR_FILE_NOT_OPENED;
+    zr_u32_t i = h[0] % fs->img_index_n, n, k, j;
 
-    max_to_read = g.fds[fd].size - g.fds[fd].curr_pos;
-    if(max_to_read < 0)
-        return 0;
-    if(max_to_read > nbytes)
-        max_to_read = nbytes;
-    fs->read_f(g.fds[fd].offset + g.fds[fd].curr_pos, buf, max_to_read);
-    g.fds[fd].curr_pos += max_to_read;
+    for(n = 0; n < fs->img_index_n; n += k) {
+        zr_index_ent_t sbuf[2];
+        const zr_index_ent_t* slots;
 
-    return max_to_read;
+        k = i + 1 < fs->img_index_n ? 2 : 1;
+        slots = __fetch(fs, fs->img_index + i * sizeof(zr_index_ent_t), sbuf,
+            k * sizeof(zr_index_ent_t), ZR_IO_LOOKUP);
+        for(j = 0; j < k; j++) {
+            if(slots[j].offset == 0)
+                return 0;
+            if(__le(slots[j].hash) == h[0] && __le(slots[j].check) == h[1]) {
+                ent->hash = h[0];
+                ent->check = h[1];
+                ent->offset = __le(slots[j].offset);
+                ent->next = __le(slots[j].next);
+                ent->spec = __le(slots[j].spec);
+                ent->size = __le(slots[j].size);
+                ent->data = __le(slots[j].data);
+                return __img_slot_ok(fs, ent) ? 1 : -1;
+            }
+        }
+        i = (i + k) % fs->img_index_n;
+    }
+    return 0;
 }
 
-zr_u32_t zr_tell(int fd)
+// returns 1 and the entry if found, 0 if the path surely doesn't exist,
+// negative if the index can't tell
+// Bloom filter first, then the RAM index, then the on-image one
+static int __index_find(zr_fs_t* fs, const char* path, zr_index_ent_t* ent)
 {
-    return g.fds[fd].curr_pos;
+    zr_index_t* idx = fs->index_buf;
+    zr_index_ent_t* ents;
+    zr_u32_t h[2], i, n;
+
+    if((fs->index_size == 0 && fs->img_index_n == 0 && fs->bloom_size == 0)
+        || __path_hash(path, h) != ZR_OK)
+        return -1;
+    if(fs->bloom_size != 0 && !__bloom_has(fs, h))
+        return 0;    // no read at all
+    if(fs->index_size == 0 && fs->img_index_n == 0)
+        return -1;
+    if(fs->index_size != 0) {
+        ents = (zr_index_ent_t*)(idx + 1);
+        i = h[0] % idx->n;
+        for(n = 0; n < idx->n && ents[i].offset != 0; n++) {
+            if(ents[i].hash == h[0] && ents[i].check == h[1]) {
+                *ent = ents[i];
+                return 1;
+            }
+            i = (i + 1) % idx->n;
+        }
+        if(idx->complete)
+            return 0;
+    }
+    if(fs->img_index_n != 0)
+        return __img_index_find(fs, h, ent);
+    return -1;
 }
 
-int zr_lseek(int fd, zr_u32_t offset, int seek_opt)
+ZR_RESULT zr_fs_mount(zr_fs_t* fs)
 {
-    if(g.fds[fd].size >= offset)
-        g.fds[fd].offset = g.fds[fd].size - 1;
-    else
-        g.fds[fd].curr_pos = offset;
+    zr_super_block_t super;
+
+    if(fs->stats != NULL)
+        __stats_clear(fs->stats);
+    if(fs->trace != NULL)
+        fs->trace->head = fs->trace->tail = 0;
+    fs->io_page = 0;
+    __dev_read(fs, fs->start, &super, sizeof(super), ZR_IO_MOUNT);
+    if(memcmp(&super, "-rom1fs-", 8) != 0)
+        return ZR_NO_FILESYSTEM;
+    fs->size = __le(super.size);
+    __cache_init(fs);
+    if(__checksum(fs) != 0)
+        return ZR_DISK_ERR;
+    __verify_init(fs);
+    __img_index_init(fs);
+    __index_build(fs);
     return ZR_OK;
 }
+
+int zr_mount(zr_fs_t* fs)
+{
+    int ret = zr_fs_mount(fs);
+    if(ret != ZR_OK)
+        return ret;
+
+    zr_lock(NULL);
+    if(g.last_volume >= ZR_MAX_VOLUMNS)
+        ret = ZR_VOLUME_NUM_EXCEED;
+    else {
+        g.volume[g.last_volume].fs = fs;
+        g.volume[g.last_volume].mounted = 1;
+        ret = g.last_volume;
+        g.last_volume++;
+    }
+    zr_unlock(NULL);
+    return ret;
+}
+
+ZR_RESULT zr_select_volume(int volume_id)
+{
+    if(volume_id >= 0 && volume_id < ZR_MAX_VOLUMNS
+        && g.volume[volume_id].mounted == 1) {
+        g.curr_volume = volume_id;
+        return ZR_OK;
+    }
+    else
+        return ZR_VOLUME_NOT_MOUNTED;
+}
+
+int zr_get_volume(void)
+{
+    return g.curr_volume;
+}
+
+zr_fs_t* zr_get_fs(int volume_id)
+{
+    if(volume_id < 0 || volume_id >= ZR_MAX_VOLUMNS
+        || g.volume[volume_id].mounted != 1)
+        return NULL;
+    return g.volume[volume_id].fs;
+}
+
+zr_stats_t* zr_get_stats(int volume_id)
+{
+    if(volume_id < 0 || volume_id >= ZR_MAX_VOLUMNS
+        || g.volume[volume_id].mounted != 1)
+        return NULL;
+    return g.volume[volume_id].fs->stats;
+}
+
+ZR_RESULT zr_reset_stats(int volume_id)
+{
+    zr_stats_t* st = zr_get_stats(volume_id);
+    if(st == NULL)
+        return ZR_VOLUME_NOT_MOUNTED;
+    __stats_clear(st);
+    return ZR_OK;
+}
+
+zr_trace_t* zr_get_trace(int volume_id)
+{
+    if(volume_id < 0 || volume_id >= ZR_MAX_VOLUMNS
+        || g.volume[volume_id].mounted != 1)
+        return NULL;
+    return g.volume[volume_id].fs->trace;
+}
+
+zr_u32_t zr_trace_copy(zr_trace_t* tr, zr_trace_rec_t* out, zr_u32_t max)
+{
+    zr_u32_t i;
+
+    if(tr->head - tr->tail > tr->n)    // overwritten before they were taken
+        tr->tail = tr->head - tr->n;
+    for(i = 0; i < max && tr->tail != tr->head; i++)
+        out[i] = tr->recs[tr->tail++ % tr->n];
+    return i;
+}
+
+ZR_RESULT zr_fs_opendir(zr_fs_t* fs, zr_dir_t* dir, const char* path)
+{
+    zr_s32_t offset;
+    zr_inode_t ibuf;
+    const zr_inode_t* inode;
+    zr_index_ent_t e;
+    int ret = __index_find(fs, path, &e);
+
+    dir->fs = fs;
+    dir->steps = 0;
+    if(ret == 0)
+        return ZR_DIR_NOT_FOUND;
+    if(ret > 0) {
+        if((e.next & 0x7) != ZR_FTYPE_DIR)
+            return ZR_NOT_A_DIR;
+        dir->offset = e.spec;
+        return ZR_OK;
+    }
+
+    dir->offset = fs->start + 16;
+    dir->offset = __skip_name(fs, dir->offset, ZR_IO_LOOKUP);
+    offset = __seek_fname(fs, dir->offset, path);
+    if(offset < 0)
+        return ZR_DIR_NOT_FOUND;
+    inode = __fetch(fs, offset, &ibuf, sizeof(ibuf), ZR_IO_LOOKUP);
+
+    if((__le(inode->next) & 0x7) != ZR_FTYPE_DIR)
+        return ZR_NOT_A_DIR;
+
+    dir->offset = __le(inode->spec);    //offset;
+    return ZR_OK;
+}
+
+ZR_RESULT zr_fs_stat(zr_fs_t* fs, const char* path, zr_finfo_t* finfo)
+{
+    zr_inode_t ibuf;
+    const zr_inode_t* inode;
+    zr_index_ent_t e;
+    zr_s32_t offset;
+    int ret = __index_find(fs, path, &e);
+
+    if(ret == 0)
+        return ZR_FILE_NOT_FOUND;
+    if(ret > 0) {    // no flash access, the name comes from the path
+        const char* p, * name = path;
+        int i;
+        for(p = path; *p != '\0'; p++)
+            if(p[0] == '/' && p[1] != '/' && p[1] != '\0')
+                name = p + 1;
+        memset(finfo->fname, 0, sizeof(finfo->fname));
+        for(i = 0; i < sizeof(finfo->fname) && name[i] != '\0'
+            && name[i] != '/'; i++)
+            finfo->fname[i] = name[i];
+        finfo->fsize = __fsize(e.next, e.spec, e.size);
+        finfo->spec = e.spec;
+        finfo->offset = e.offset;
+        finfo->next = e.next & (~0xf);
+        finfo->ftype = e.next & 0x7;
+        return ZR_OK;
+    }
+
+    offset = fs->start + 16;
+    offset = __skip_name(fs, offset, ZR_IO_LOOKUP);
+    offset = __seek_fname(fs, offset, path);
+    if(offset < 0)
+        return ZR_FILE_NOT_FOUND;
+    if(fs->base != NULL) {
+        inode = __fetch(fs, offset, &ibuf, sizeof(ibuf), ZR_IO_LOOKUP);
+        memcpy(finfo->fname, inode + 1, sizeof(finfo->fname));
+    }
+    else {
+        __read_entry(fs, offset, &ibuf, finfo->fname, ZR_IO_LOOKUP);
+        inode = &ibuf;
+    }
+
+    finfo->fsize = __fsize(__le(inode->next), __le(inode->spec),
+        __le(inode->size));
+    finfo->spec = __le(inode->spec);
+    finfo->offset = offset;
+    finfo->next = __le(inode->next) & (~0xf);
+    finfo->ftype = __le(inode->next) & 0x7;
+
+    return ZR_OK;
+}
+
+int zr_readdir(zr_dir_t* dir, zr_finfo_t* finfo)
+{
+    zr_inode_t ibuf;
+    const zr_inode_t* inode;
+    zr_fs_t* fs = dir->fs;
+
+    if(dir->offset == fs->start)
+        return ZR_NO_FILE;
+    if(!__in_image(fs, dir->offset, 32) || dir->steps++ > fs->size / 32)
+        return ZR_DISK_ERR;
+    if(fs->base != NULL) {
+        inode = __fetch(fs, dir->offset, &ibuf, sizeof(ibuf), ZR_IO_READDIR);
+        memcpy(finfo->fname, inode + 1, sizeof(finfo->fname));
+    }
+    else {
+        __read_entry(fs, dir->offset, &ibuf, finfo->fname, ZR_IO_READDIR);
+        inode = &ibuf;
+    }
+
+    finfo->fsize = __fsize(__le(inode->next), __le(inode->spec),
+        __le(inode->size));
+    finfo->spec = __le(inode->spec);
+    finfo->offset = dir->offset;
+    finfo->next = __le(inode->next) & (~0xf);
+    finfo->ftype = __le(inode->next) & 0x7;
+    dir->offset = __le(inode->next) & (~0xf);
+
+    return ZR_OK;
+}
+
+// directory bytes read at once by zr_readdir_batch(), offset of buf[0]
+typedef struct {
+    zr_u32_t offset, len;
+    zr_u8_t buf[ZR_READDIR_WINDOW];
+} zr_window_t;
+
+// len bytes at offset, on a miss the window is refilled from offset with
+// want bytes, or less at the end of the image
+static const zr_u8_t* __window(zr_fs_t* fs, zr_window_t* w, zr_u32_t offset,
+    zr_u32_t len, zr_u32_t want)
+{
+    zr_u32_t end = fs->start + fs->size;
+
+    if(fs->base != NULL)
+        return (const zr_u8_t*)fs->base + offset;
+    if(offset < w->offset || offset + len > w->offset + w->len) {
+        if(end > offset && want > end - offset)
+            want = end - offset;
+        if(want < len)
+            want = len;
+        __read(fs, offset, w->buf, want, ZR_IO_READDIR);
+        w->offset = offset;
+        w->len = want;
+    }
+    return w->buf + offset - w->offset;
+}
+
+int zr_readdir_batch(zr_dir_t* dir, zr_finfo_t* items, int max, char* names,
+    zr_u32_t names_size, int flags)
+{
+    zr_fs_t* fs = dir->fs;
+    zr_window_t w;
+    zr_u32_t used = 0, want = ZR_READDIR_WINDOW;
+    int n = 0;
+
+    w.offset = w.len = 0;
+    if(names_size == 0)
+        names = NULL;
+    while(n < max && dir->offset != fs->start) {
+        zr_dirent_t ent;
+        zr_finfo_t* finfo = &items[n];
+        zr_u32_t start = used, off = dir->offset + 16, next;
+        const char* chunk, * end;
+        int i, full = 0;
+
+        // what was listed so far first, the error on the next call
+        if(!__in_image(fs, dir->offset, sizeof(ent))
+            || dir->steps++ > fs->size / 32)
+            return n > 0 ? n : ZR_DISK_ERR;
+        memcpy(&ent, __window(fs, &w, dir->offset, sizeof(ent), want),
+            sizeof(ent));
+        memcpy(finfo->fname, ent.name, sizeof(finfo->fname));
+        do {    // the name, 16 bytes at a time
+            if(!__in_image(fs, off, 16))
+                return n > 0 ? n : ZR_DISK_ERR;
+            chunk = (const char*)__window(fs, &w, off, 16, want);
+            end = memchr(chunk, '\0', 16);
+            i = end != NULL ? end - chunk : 16;
+            if(names != NULL && used + i >= names_size) {    // keep room for the '\0'
+                i = used < names_size ? names_size - 1 - used : 0;
+                full = 1;
+            }
+            if(names != NULL) {
+                if(used + 16 <= names_size)    // a fixed size copy is cheaper
+                    memcpy(names + used, chunk, 16);
+                else
+                    memcpy(names + used, chunk, i);
+                used += i;
+            }
+            off += 16;
+        } while(chunk[15] != '\0');
+        if(full && n > 0) {    // next batch, the first one gets truncated
+            used = start;
+            dir->steps--;    // read again then
+            break;
+        }
+        if(names != NULL)
+            names[used++] = '\0';
+
+        next = __le(ent.inode.next) & (~0xf);
+        // entries listed back to back share a window, otherwise just the header
+        want = next >= off && next - off < ZR_READDIR_WINDOW / 2 ?
+            ZR_READDIR_WINDOW : 32;
+        if((flags & ZR_READDIR_SKIP_DOTS) && (memcmp(finfo->fname, ".", 2) == 0
+            || memcmp(finfo->fname, "..", 3) == 0)) {
+            used = start;
+            dir->offset = next;
+            continue;
+        }
+        finfo->fsize = __fsize(__le(ent.inode.next), __le(ent.inode.spec),
+            __le(ent.inode.size));
+        finfo->spec = __le(ent.inode.spec);
+        finfo->offset = dir->offset;
+        finfo->next = next;
+        finfo->ftype = __le(ent.inode.next) & 0x7;
+        dir->offset = next;
+        n++;
+    }
+    return n;
+}
+
+#if ZR_LZ4_BLOCK_SIZE > 0
+// A compressed file's data starts with "ZRLZ", the uncompressed size, the
+// block size shift and 3 reserved bytes, the block count, then nblocks + 1
+// BE offsets from the data start, bit 31 set on blocks stored raw. Each
+// block is a raw LZ4 block that decodes on its own, zr_mkromfs -z checks
+// they also decode in place in ZR_LZ4_MARGIN bytes of slack.
+static ZR_RESULT __z_open(zr_fs_t* fs, zr_file_t* fp)
+{
+    zr_u32_t hdr[4], shift;
+
+    if(__verify_range(fs, fp->offset, sizeof(hdr)) != ZR_OK)
+        return ZR_DISK_ERR;
+    __read(fs, fp->offset, hdr, sizeof(hdr), ZR_IO_LOOKUP);
+    shift = __le(hdr[2]) >> 24;
+    if(memcmp(hdr, "ZRLZ", 4) != 0 || __le(hdr[1]) != fp->size || shift < 4
+        || shift > 24 || __le(hdr[3]) != (fp->size + (1UL << shift) - 1) >> shift)
+        return ZR_DISK_ERR;
+    if((1UL << shift) > ZR_LZ4_BLOCK_SIZE)
+        return ZR_FILETYPE_NOT_SUPPORTED;    // blocks larger than z_buf
+    fp->z_table = fp->offset + sizeof(hdr);
+    fp->z_shift = shift;
+    fp->z_block = ~0;
+    fp->z_tab0 = ~0;
+    return ZR_OK;
+}
+#endif
+
+ZR_RESULT zr_file_open(zr_fs_t* fs, zr_file_t* fp, const char* path)
+{
+    zr_finfo_t finfo;
+    zr_index_ent_t e;
+    zr_u32_t next, spec;
+    int ret = __index_find(fs, path, &e);
+
+    if(ret == 0)
+        return ZR_FILE_NOT_FOUND;
+    if(ret > 0) {
+        fp->size = __fsize(e.next, e.spec, e.size);
+        fp->offset = e.data;
+        next = e.next;
+        spec = e.spec;
+    }
+    else {
+        ret = zr_fs_stat(fs, path, &finfo);
+        if(ret != ZR_OK)
+            return ret;
+        fp->size = finfo.fsize;
+        if(finfo.fname[15] == '\0')    // zr_fs_stat already read the whole name
+            fp->offset = finfo.offset + 32;
+        else
+            fp->offset = __skip_name(fs, finfo.offset + 32, ZR_IO_LOOKUP);
+        next = finfo.ftype;
+        spec = finfo.spec;
+    }
+    // mapped volumes hand out the data as is, compressed files only have
+    // their header checked here and each block in __z_load
+    if(!__in_image(fs, fp->offset,
+        __fsize(next, spec, 0) != 0 ? 16 : fp->size))
+        return ZR_DISK_ERR;
+#if ZR_LZ4_BLOCK_SIZE > 0
+    fp->z_table = 0;
+    if(__fsize(next, spec, 0) != 0) {
+        ret = __z_open(fs, fp);
+        if(ret != ZR_OK)
+            return ret;
+    }
+#endif
+    fp->curr_pos = 0;
+#if ZR_READAHEAD_SIZE > 0
+    fp->ra_len = 0;
+    fp->ra_win = 0;
+    fp->advice = ZR_ADV_NORMAL;
+    fp->seq = 1;    // reading from the start counts as sequential
+#endif
+    fp->fs = fs;
+    return ZR_OK;
+}
+
+ZR_RESULT zr_file_close(zr_file_t* fp)
+{
+    if(fp->fs == NULL)
+        return ZR_FILE_NOT_OPENED;
+    fp->fs = NULL;
+    return ZR_OK;
+}
+
+// bytes left from the current position, at most n
+static zr_u32_t __clamp(const zr_file_t* fp, zr_u32_t n)
+{
+    if(fp->curr_pos >= fp->size)
+        return 0;
+    return fp->size - fp->curr_pos < n ? fp->size - fp->curr_pos : n;
+}
+
+#if ZR_READAHEAD_SIZE > 0
+static void __ra_fill(zr_file_t* fp, zr_u32_t win)
+{
+    fp->ra_pos = fp->curr_pos;
+    fp->ra_len = __clamp(fp, win);
+    __read(fp->fs, fp->offset + fp->ra_pos, fp->ra_buf, fp->ra_len,
+        ZR_IO_DATA);
+}
+
+// serve what ra_buf holds at curr_pos, returns bytes copied
+static zr_u32_t __ra_copy(zr_file_t* fp, zr_u8_t* buf, zr_u32_t n)
+{
+    zr_u32_t skip = fp->curr_pos - fp->ra_pos;
+
+    if(fp->curr_pos < fp->ra_pos || skip >= fp->ra_len)
+        return 0;
+    if(n > fp->ra_len - skip)
+        n = fp->ra_len - skip;
+    memcpy(buf, fp->ra_buf + skip, n);
+    fp->curr_pos += n;
+    return n;
+}
+#endif
+
+#if ZR_LZ4_BLOCK_SIZE > 0
+// in-place safe LZ4 block decoder: literals are moved, matches copied
+// forward, so src may sit at the tail of dst. Returns the decoded size or -1.
+static int __lz4_decode(const zr_u8_t* src, zr_u32_t slen, zr_u8_t* dst,
+    zr_u32_t dcap)
+{
+    const zr_u8_t* end = src + slen;
+    zr_u32_t op = 0, len, dist;
+
+    while(src < end) {
+        zr_u8_t token = *src++;
+
+        len = token >> 4;
+        if(len == 15) {
+            do {
+                if(src >= end)
+                    return -1;
+                len += *src;
+            } while(*src++ == 255);
+        }
+        if(len > (zr_u32_t)(end - src) || len > dcap - op)
+            return -1;
+        memmove(dst + op, src, len);
+        src += len;
+        op += len;
+        if(src == end)
+            break;    // the last sequence has no match
+        if(end - src < 2)
+            return -1;
+        dist = src[0] | (zr_u32_t)src[1] << 8;
+        src += 2;
+        len = (token & 15) + 4;
+        if((token & 15) == 15) {
+            do {
+                if(src >= end)
+                    return -1;
+                len += *src;
+            } while(*src++ == 255);
+        }
+        if(dist == 0 || dist > op || len > dcap - op)
+            return -1;
+        for(; len > 0; len--, op++)
+            dst[op] = dst[op - dist];
+    }
+    return op;
+}
+
+// decode block b of a compressed file into z_buf
+static ZR_RESULT __z_load(zr_file_t* fp, zr_u32_t b)
+{
+    zr_fs_t* fs = fp->fs;
+    zr_u32_t bsize = 1UL << fp->z_shift, nblocks, start, end, len, i;
+    int raw, n;
+
+    if(b == fp->z_block)
+        return ZR_OK;
+    nblocks = (fp->size + bsize - 1) >> fp->z_shift;
+    if(b < fp->z_tab0 || b + 1 >= fp->z_tab0 + 9) {    // cache 8 blocks of table
+        n = nblocks + 1 - b < 9 ? nblocks + 1 - b : 9;
+        if(!__in_image(fs, fp->z_table + b * 4, n * 4)
+            || __verify_range(fs, fp->z_table + b * 4, n * 4) != ZR_OK)
+            return ZR_DISK_ERR;
+        __read(fs, fp->z_table + b * 4, fp->z_tab, n * 4, ZR_IO_DATA);
+        for(i = 0; i < n; i++)
+            fp->z_tab[i] = __le(fp->z_tab[i]);
+        fp->z_tab0 = b;
+    }
+    start = fp->z_tab[b - fp->z_tab0];
+    end = fp->z_tab[b + 1 - fp->z_tab0] & 0x7fffffff;
+    raw = start >> 31;
+    start &= 0x7fffffff;
+    len = b + 1 < nblocks ? bsize : fp->size - b * bsize;
+    fp->z_block = ~0;
+    if(end < start || end - start > sizeof(fp->z_buf)
+        || !__in_image(fs, fp->offset + start, end - start)
+        || __verify_range(fs, fp->offset + start, end - start) != ZR_OK)
+        return ZR_DISK_ERR;
+    if(raw) {
+        if(end - start != len)
+            return ZR_DISK_ERR;
+        __read(fs, fp->offset + start, fp->z_buf, len, ZR_IO_DATA);
+        n = len;
+    }
+    else if(fs->base != NULL)
+        n = __lz4_decode((const zr_u8_t*)fs->base + fp->offset + start,
+            end - start, fp->z_buf, len);
+    else {
+        zr_u8_t* src = fp->z_buf + sizeof(fp->z_buf) - (end - start);
+        __read(fs, fp->offset + start, src, end - start, ZR_IO_DATA);
+        n = __lz4_decode(src, end - start, fp->z_buf, len);
+    }
+    if(n != len)
+        return ZR_DISK_ERR;
+    fp->z_block = b;
+    return ZR_OK;
+}
+
+static int __z_read(zr_file_t* fp, zr_u8_t* buf, zr_u32_t nbytes)
+{
+    zr_u32_t max_to_read = __clamp(fp, nbytes), done = 0;
+    zr_u32_t mask = (1UL << fp->z_shift) - 1;
+
+    while(done < max_to_read) {
+        zr_u32_t skip = fp->curr_pos & mask, len = mask + 1 - skip;
+
+        if(__z_load(fp, fp->curr_pos >> fp->z_shift) != ZR_OK)
+            return ZR_DISK_ERR;
+        if(len > max_to_read - done)
+            len = max_to_read - done;
+        memcpy(buf + done, fp->z_buf + skip, len);
+        done += len;
+        fp->curr_pos += len;
+    }
+    return max_to_read;
+}
+#endif
+
+int zr_file_read(zr_file_t* fp, void* buf, zr_u32_t nbytes)
+{
+    zr_u32_t max_to_read, done = 0;
+    if(fp->fs == NULL)
+        return ZR_FILE_NOT_OPENED;
+#if ZR_LZ4_BLOCK_SIZE > 0
+    if(fp->z_table != 0)
+        return __z_read(fp, buf, nbytes);
+#endif
+
+    max_to_read = __clamp(fp, nbytes);
+    if(__verify_range(fp->fs, fp->offset + fp->curr_pos, max_to_read) != ZR_OK)
+        return ZR_DISK_ERR;
+#if ZR_READAHEAD_SIZE > 0
+    if(fp->fs->base == NULL) {
+        done = __ra_copy(fp, buf, max_to_read);
+        if(done < max_to_read && fp->advice != ZR_ADV_RANDOM
+            && (fp->seq || fp->advice == ZR_ADV_SEQUENTIAL)
+            && max_to_read - done < ZR_READAHEAD_SIZE) {
+            // sequential small reads: grow the window up to the buffer size
+            if(fp->advice == ZR_ADV_SEQUENTIAL)
+                fp->ra_win = ZR_READAHEAD_SIZE;
+            else if(fp->ra_win == 0)
+                fp->ra_win = ZR_READAHEAD_SIZE / 4;
+            else if(fp->ra_win < ZR_READAHEAD_SIZE / 2)
+                fp->ra_win *= 2;
+            else    // a window started at an odd size must not double past it
+                fp->ra_win = ZR_READAHEAD_SIZE;
+            if(fp->ra_win < max_to_read - done)
+                fp->ra_win = max_to_read - done;
+            __ra_fill(fp, fp->ra_win);
+            done += __ra_copy(fp, (zr_u8_t*)buf + done, max_to_read - done);
+        }
+        fp->seq = 1;
+    }
+#endif
+    __read(fp->fs, fp->offset + fp->curr_pos, (zr_u8_t*)buf + done,
+        max_to_read - done, ZR_IO_DATA);
+    fp->curr_pos += max_to_read - done;
+
+    return max_to_read;
+}
+
+int zr_file_read_async(zr_file_t* fp, void* buf, zr_u32_t nbytes,
+    zr_done_f on_done, void* ctx)
+{
+    zr_u32_t max_to_read, offset;
+    zr_fs_t* fs = fp->fs;
+    if(fs == NULL)
+        return ZR_FILE_NOT_OPENED;
+#if ZR_LZ4_BLOCK_SIZE > 0
+    if(fp->z_table != 0) {    // decoding is CPU work, done right here
+        int n = __z_read(fp, buf, nbytes);
+        if(n >= 0)
+            on_done(ctx, n);
+        return n;
+    }
+#endif
+
+    max_to_read = __clamp(fp, nbytes);
+    offset = fp->offset + fp->curr_pos;
+    if(__verify_range(fs, offset, max_to_read) != ZR_OK)
+        return ZR_DISK_ERR;
+    fp->curr_pos += max_to_read;    // the range is ours once queued
+
+    if(max_to_read == 0 || fs->base != NULL || fs->read_async_f == NULL) {
+        __read(fs, offset, buf, max_to_read, ZR_IO_DATA);
+        on_done(ctx, max_to_read);
+    }
+    else {
+        zr_u32_t t0 = __clock(fs);
+        fs->read_async_f(fs, offset, buf, max_to_read, on_done, ctx);
+        if(fs->stats != NULL)    // counted when queued, only submission is timed
+            __account(fs, ZR_IO_DATA, max_to_read, t0);
+        if(fs->trace != NULL)
+            __trace(fs, ZR_IO_DATA, offset, max_to_read);
+    }
+    return max_to_read;
+}
+
+ZR_RESULT zr_file_read_ptr(zr_file_t* fp, const void** ptr, zr_u32_t* len)
+{
+    if(fp->fs == NULL)
+        return ZR_FILE_NOT_OPENED;
+    if(fp->fs->base == NULL)
+        return ZR_VOLUME_NOT_MAPPED;
+#if ZR_LZ4_BLOCK_SIZE > 0
+    if(fp->z_table != 0)
+        return ZR_FILETYPE_NOT_SUPPORTED;    // no plain bytes in the image
+#endif
+
+    *len = __clamp(fp, *len);
+    if(__verify_range(fp->fs, fp->offset + fp->curr_pos, *len) != ZR_OK)
+        return ZR_DISK_ERR;
+    *ptr = (const zr_u8_t*)fp->fs->base + fp->offset + fp->curr_pos;
+    fp->curr_pos += *len;
+
+    return ZR_OK;
+}
+
+// busy is cleared by the backend's thread or interrupt once data and result
+// are written, release there and acquire here order them where the compiler
+// knows how, a single core MCU only needs the volatile
+#if defined(__GNUC__)
+#define __done_set(p) __atomic_store_n(p, 0, __ATOMIC_RELEASE)
+#define __done_get(p) (__atomic_load_n(p, __ATOMIC_ACQUIRE) == 0)
+#else
+#define __done_set(p) (*(p) = 0)
+#define __done_get(p) (*(p) == 0)
+#endif
+
+typedef struct {
+    zr_u8_t data[ZR_STREAM_CHUNK];
+    zr_u32_t size;
+    int result;
+    volatile zr_u8_t busy;      // cleared by __stream_done, maybe from another thread
+} __chunk_t;
+
+static void __stream_done(void* ctx, int result)
+{
+    __chunk_t* c = ctx;
+    c->result = result;
+    __done_set(&c->busy);
+}
+
+// without poll_f there is nothing to wait with but a spin, so the chunk is
+// read right here and only the sink's work is not overlapped
+static int __stream_fetch(zr_file_t* fp, __chunk_t* c, zr_u32_t size)
+{
+    int ret;
+
+    c->size = size;
+    if(fp->fs->poll_f == NULL) {
+        c->busy = 0;
+        c->result = ret = zr_file_read(fp, c->data, size);
+        return ret;
+    }
+    c->busy = 1;
+    ret = zr_file_read_async(fp, c->data, size, __stream_done, c);
+    if(ret < 0)
+        c->busy = 0;
+    else
+        fp->fs->poll_f(fp->fs, 0);    // on its way while the sink works
+    return ret;
+}
+
+static int __stream_wait(zr_fs_t* fs, __chunk_t* c)
+{
+    while(!__done_get(&c->busy))    // only set with a poll_f
+        fs->poll_f(fs, 1);
+    return c->result == (int)c->size ? c->result : ZR_DISK_ERR;
+}
+
+// mapped volumes hand out the image itself, the others fill one chunk
+// while the sink works on the other one
+int zr_file_stream(zr_file_t* fp, zr_u32_t length, zr_sink_f sink, void* ctx,
+    zr_u32_t chunk_hint)
+{
+    __chunk_t c[2];
+    const void* p;
+    zr_u32_t start = fp->curr_pos, queued, done = 0, n;
+    int i = 0, ret = ZR_OK;
+    if(fp->fs == NULL)
+        return ZR_FILE_NOT_OPENED;
+
+    length = __clamp(fp, length);
+    if(fp->fs->base != NULL
+#if ZR_LZ4_BLOCK_SIZE > 0
+        && fp->z_table == 0
+#endif
+        ) {
+        while(ret >= 0 && done < length) {
+            n = chunk_hint != 0 && chunk_hint < length - done ? chunk_hint
+                : length - done;
+            ret = zr_file_read_ptr(fp, &p, &n);
+            if(ret == ZR_OK)
+                ret = sink(ctx, p, n);
+            if(ret >= 0)
+                done += n;
+        }
+    }
+    else {
+        if(chunk_hint == 0 || chunk_hint > ZR_STREAM_CHUNK)
+            chunk_hint = ZR_STREAM_CHUNK;
+        c[0].busy = c[1].busy = 0;
+        queued = length < chunk_hint ? length : chunk_hint;
+        if(queued > 0)
+            ret = __stream_fetch(fp, &c[0], queued);
+        while(ret >= 0 && done < length) {
+            if(queued < length) {
+                n = length - queued < chunk_hint ? length - queued : chunk_hint;
+                ret = __stream_fetch(fp, &c[i ^ 1], n);
+                if(ret < 0)
+                    break;
+                queued += n;
+            }
+            ret = __stream_wait(fp->fs, &c[i]);
+            if(ret >= 0)
+                ret = sink(ctx, c[i].data, c[i].size);
+            if(ret >= 0)
+                done += c[i].size;
+            i ^= 1;
+        }
+        while(!__done_get(&c[0].busy) || !__done_get(&c[1].busy))
+            fp->fs->poll_f(fp->fs, 1);    // the buffers go away with us
+    }
+    if(ret < 0) {    // stop right after what the sink took
+        zr_file_lseek(fp, start + done, 0);
+        return ret;
+    }
+    return done;
+}
+
+zr_u32_t zr_file_tell(zr_file_t* fp)
+{
+    return fp->curr_pos;
+}
+
+ZR_RESULT zr_file_lseek(zr_file_t* fp, zr_u32_t offset, int seek_opt)
+{
+    if(fp->fs == NULL)
+        return ZR_FILE_NOT_OPENED;
+    if(offset > fp->size)
+        offset = fp->size;
+#if ZR_READAHEAD_SIZE > 0
+    if(offset != fp->curr_pos) {    // random access, restart the window
+        fp->seq = 0;
+        fp->ra_win = 0;
+    }
+#endif
+    fp->curr_pos = offset;
+    return ZR_OK;
+}
+
+ZR_RESULT zr_file_advise(zr_file_t* fp, int advice)
+{
+    if(fp->fs == NULL)
+        return ZR_FILE_NOT_OPENED;
+#if ZR_LZ4_BLOCK_SIZE > 0
+    if(fp->z_table != 0) {    // read a block at a time, nothing to tune
+        if(advice == ZR_ADV_WILLNEED && fp->curr_pos < fp->size)
+            __z_load(fp, fp->curr_pos >> fp->z_shift);
+        return ZR_OK;
+    }
+#endif
+#if ZR_READAHEAD_SIZE > 0
+    if(advice == ZR_ADV_WILLNEED) {
+        if(fp->fs->base == NULL)
+            __ra_fill(fp, ZR_READAHEAD_SIZE);
+    }
+    else
+        fp->advice = advice;
+#endif
+    return ZR_OK;
+}
+
+// a layer answers unless the path is missing there, so a file on top
+// hides a directory of the same name below
+ZR_RESULT zr_overlay_stat(const zr_overlay_t* ov, const char* path,
+    zr_finfo_t* finfo)
+{
+    int i, ret = ZR_FILE_NOT_FOUND;
+
+    for(i = 0; i < ov->n && ret == ZR_FILE_NOT_FOUND; i++)
+        ret = zr_fs_stat(ov->layers[i], path, finfo);
+    return ret;
+}
+
+ZR_RESULT zr_overlay_opendir(const zr_overlay_t* ov, zr_dir_t* dir,
+    const char* path)
+{
+    int i, ret = ZR_DIR_NOT_FOUND;
+
+    for(i = 0; i < ov->n && ret == ZR_DIR_NOT_FOUND; i++)
+        ret = zr_fs_opendir(ov->layers[i], dir, path);
+    return ret;
+}
+
+ZR_RESULT zr_overlay_open(const zr_overlay_t* ov, zr_file_t* fp,
+    const char* path)
+{
+    int i, ret = ZR_FILE_NOT_FOUND;
+
+    for(i = 0; i < ov->n && ret == ZR_FILE_NOT_FOUND; i++)
+        ret = zr_file_open(ov->layers[i], fp, path);
+    return ret;
+}
+
+// the fd API below works on the selected volume, fds remember their own
+int zr_opendir(zr_dir_t* dir, const char* path)
+{
+    return zr_fs_opendir(g.volume[g.curr_volume].fs, dir, path);
+}
+
+int zr_stat(const char* path, zr_finfo_t* finfo)
+{
+    return zr_fs_stat(g.volume[g.curr_volume].fs, path, finfo);
+}
+
+#define ZR_FD_NONE 0xffff    // end of the free list
+#define ZR_FD_MASK ((1U << ZR_FD_INDEX_BITS) - 1)
+#define ZR_FD_GEN_MASK ((1U << (sizeof(int) * 8 - 1 - ZR_FD_INDEX_BITS)) - 1)
+
+static void __pool_init(zr_fd_slot_t* pool, zr_u32_t n)
+{
+    zr_u32_t i;
+
+    if(n > ZR_FD_MASK - 3)    // fds stay below 1 << ZR_FD_INDEX_BITS
+        n = ZR_FD_MASK - 3;
+    for(i = 0; i < n; i++) {
+        pool[i].file.fs = NULL;
+        pool[i].gen = 0;
+        pool[i].next = i + 1 < n ? i + 1 : ZR_FD_NONE;
+    }
+    g.pool = pool;
+    g.pool_n = n;
+    g.pool_used = 0;
+    g.pool_free = n > 0 ? 0 : ZR_FD_NONE;
+}
+
+ZR_RESULT zr_set_fd_pool(void* buf, zr_u32_t size)
+{
+    ZR_RESULT ret = ZR_OK;
+
+    zr_lock(NULL);
+    if(g.pool_used != 0)
+        ret = ZR_FILES_OPENED;
+    else if(buf == NULL)
+        __pool_init(g.fds, ZR_MAX_OPENED_FILES);
+    else
+        __pool_init(buf, size / sizeof(zr_fd_slot_t));
+    zr_unlock(NULL);
+    return ret;
+}
+
+// the open file behind fd, NULL for fds closed or never handed out
+static zr_file_t* __fd(int fd)
+{
+    zr_u32_t i = ((zr_u32_t)fd & ZR_FD_MASK) - 3;
+    zr_fd_slot_t* slot;
+
+    if(fd < 3 || i >= g.pool_n)
+        return NULL;
+    slot = &g.pool[i];
+    if(slot->gen != (fd >> ZR_FD_INDEX_BITS) || slot->file.fs == NULL)
+        return NULL;
+    return &slot->file;
+}
+
+// a fd for an open file, copied into a free pool slot
+static int __fd_new(const zr_file_t* f)
+{
+    zr_fd_slot_t* slot;
+    int fd = ZR_OPENED_FILE_EXCEED;
+
+    zr_lock(NULL);
+    if(g.pool == NULL)
+        __pool_init(g.fds, ZR_MAX_OPENED_FILES);
+    if(g.pool_free != ZR_FD_NONE) {
+        slot = &g.pool[g.pool_free];
+        fd = (int)slot->gen << ZR_FD_INDEX_BITS | (g.pool_free + 3);    //skips system FDs
+        g.pool_free = slot->next;
+        g.pool_used++;
+        slot->file = *f;
+    }
+    zr_unlock(NULL);
+    return fd;
+}
+
+int zr_open(const char* path)
+{
+    zr_file_t f;
+    int ret = zr_file_open(g.volume[g.curr_volume].fs, &f, path);
+    if(ret != ZR_OK)
+        return ret;
+    return __fd_new(&f);
+}
+
+int zr_open_overlay(const zr_overlay_t* ov, const char* path)
+{
+    zr_file_t f;
+    int ret = zr_overlay_open(ov, &f, path);
+    if(ret != ZR_OK)
+        return ret;
+    return __fd_new(&f);
+}
+
+int zr_close(int fd)
+{
+    zr_file_t* fp;
+    zr_fd_slot_t* slot;
+    int ret = ZR_FILE_NOT_OPENED;
+
+    zr_lock(NULL);
+    fp = __fd(fd);
+    if(fp != NULL) {    // a new generation, fd goes stale
+        slot = (zr_fd_slot_t*)fp;
+        ret = zr_file_close(fp);
+        slot->gen = (slot->gen + 1) & ZR_FD_GEN_MASK;
+        slot->next = g.pool_free;
+        g.pool_free = slot - g.pool;
+        g.pool_used--;
+    }
+    zr_unlock(NULL);
+    return ret;
+}
+
+int zr_read(int fd, void* buf, zr_u32_t nbytes)
+{
+    zr_file_t* fp = __fd(fd);
+    return fp ? zr_file_read(fp, buf, nbytes) : ZR_FILE_NOT_OPENED;
+}
+
+int zr_read_async(int fd, void* buf, zr_u32_t nbytes, zr_done_f on_done,
+    void* ctx)
+{
+    zr_file_t* fp = __fd(fd);
+    if(fp == NULL)
+        return ZR_FILE_NOT_OPENED;
+    return zr_file_read_async(fp, buf, nbytes, on_done, ctx);
+}
+
+int zr_stream(int fd, zr_u32_t length, zr_sink_f sink, void* ctx,
+    zr_u32_t chunk_hint)
+{
+    zr_file_t* fp = __fd(fd);
+    if(fp == NULL)
+        return ZR_FILE_NOT_OPENED;
+    return zr_file_stream(fp, length, sink, ctx, chunk_hint);
+}
+
+int zr_read_ptr(int fd, const void** ptr, zr_u32_t* len)
+{
+    zr_file_t* fp = __fd(fd);
+    return fp ? zr_file_read_ptr(fp, ptr, len) : ZR_FILE_NOT_OPENED;
+}
+
+zr_u32_t zr_tell(int fd)
+{
+    zr_file_t* fp = __fd(fd);
+    return fp ? zr_file_tell(fp) : 0;
+}
+
+int zr_lseek(int fd, zr_u32_t offset, int seek_opt)
+{
+    zr_file_t* fp = __fd(fd);
+    return fp ? zr_file_lseek(fp, offset, seek_opt) : ZR_FILE_NOT_OPENED;
+}
+
+int zr_fadvise(int fd, int advice)
+{
+    zr_file_t* fp = __fd(fd);
+    return fp ? zr_file_advise(fp, advice) : ZR_FILE_NOT_OPENED;
+}
@@ -10,12 +10,40 @@ extern "C" {
 #define ZR_ENDIAN_LITTLE        // x86, avr, arm
 //#define ZR_ENDIAN_BIG         // 51, stm8
 #define ZR_MAX_VOLUMNS 2
-#define ZR_MAX_OPENED_FILES 2
+#define ZR_MAX_OPENED_FILES 2   // built-in fd pool, zr_set_fd_pool() for more
+#define ZR_CACHE_SECTOR_SIZE 256    // block cache sector size, power of 2
+#define ZR_CACHE_BYTES(n) (8 + (n) * (4 + ZR_CACHE_SECTOR_SIZE))    // RAM for n sectors
+#ifndef ZR_READAHEAD_SIZE
+#define ZR_READAHEAD_SIZE 0     // per-file read-ahead buffer in every zr_file_t and fd slot, 0 = off
+#endif
+#if ZR_READAHEAD_SIZE > 65535
+#error "ZR_READAHEAD_SIZE is at most 65535, the window is 16 bits"
+#endif
+#ifndef ZR_REENTRANT
+#define ZR_REENTRANT 0          // 1: call zr_lock()/zr_unlock() around shared state
+#endif
+#define ZR_INDEX_BYTES(n) (12 + (n) * 28)    // RAM for n path index slots, keep n >= 4/3 * entries
+#define ZR_BLOOM_BYTES(n) (((n) * 10 + 31) / 32 * 4)    // RAM for a path Bloom filter of n entries, about 1% false hits
+#define ZR_BLOOM_HASHES 4       // bits set per path
+#define ZR_MAX_DEPTH 32         // directory levels the mount-time walk and zr_fsck() go down
+#ifndef ZR_LZ4_BLOCK_SIZE
+#define ZR_LZ4_BLOCK_SIZE 0     // largest block of compressed files, power of 2, 0 = read them raw
+#endif
+#define ZR_LZ4_MARGIN 32        // in-place decoding slack, part of the file format
+#ifndef ZR_IO_MEM_ALIGN
+#define ZR_IO_MEM_ALIGN 4       // buffer alignment of io_align transfers, others go through io_bounce
+#endif
+#ifndef ZR_READDIR_WINDOW
+#define ZR_READDIR_WINDOW 256   // directory bytes zr_readdir_batch() reads at once, on the stack
+#endif
+#ifndef ZR_STREAM_CHUNK
+#define ZR_STREAM_CHUNK 512     // largest piece zr_stream() hands the sink from a copy, caps chunk_hint, two of them on the stack
+#endif
 
-typedef unsigned char zr_u8_t;
-typedef unsigned short zr_u16_t;
-typedef unsigned long zr_u32_t;
-typedef signed long zr_s32_t;
+typedef uint8_t zr_u8_t;
+typedef uint16_t zr_u16_t;
+typedef uint32_t zr_u32_t;
+typedef int32_t zr_s32_t;
 
 typedef enum {
     ZR_OK = 0,
@@ -29,7 +57,9 @@ typedef enum {
     ZR_FILE_NOT_OPENED = -8,
     ZR_OPENED_FILE_EXCEED = -9,
     ZR_VOLUME_NOT_MOUNTED = -10,
-    ZR_VOLUME_NUM_EXCEED = -11
+    ZR_VOLUME_NUM_EXCEED = -11,
+    ZR_VOLUME_NOT_MAPPED = -12,
+    ZR_FILES_OPENED = -13
 } ZR_RESULT;
 
 enum {
@@ -44,15 +74,166 @@ enum {
 };
 
 typedef struct {
+    zr_u32_t offset;
+    void* buf;
+    zr_u32_t size;
+} zr_iovec_t;
+
+enum {
+    ZR_VERIFY_ON_READ = 1,      // verify a region the first time data is read from it
+    ZR_VERIFY_STRICT = 2        // reject reads from regions that fail verification, re-checked each time without verify_bad
+};
+
+typedef void (*zr_done_f)(void* ctx, int result);    // result: bytes read or error
+typedef int (*zr_sink_f)(void* ctx, const void* buf, zr_u32_t size);    // 0 to go on, a negative code stops zr_stream()
+
+enum {
+    ZR_IO_MOUNT,                // superblock, path index build
+    ZR_IO_LOOKUP,               // path walks of open/stat/opendir
+    ZR_IO_READDIR,
+    ZR_IO_DATA,                 // file contents, read-ahead, async reads
+    ZR_IO_CHECKSUM,             // superblock checksum, region verification
+    ZR_IO_ORIGINS
+};
+#define ZR_STATS_BUCKETS 16     // size histogram, bucket i counts [2^i, 2^(i+1)), the last one the rest
+
+typedef struct {
+    zr_u32_t calls, bytes;
+    zr_u32_t hist[ZR_STATS_BUCKETS];
+    zr_u32_t origin_calls[ZR_IO_ORIGINS];
+    zr_u32_t origin_bytes[ZR_IO_ORIGINS];
+    zr_u32_t (*clock)(void);    // optional timestamp source, any unit
+    zr_u32_t time, time_max;    // clock ticks spent in the backend, slowest call
+    zr_u32_t origin_time[ZR_IO_ORIGINS];
+} zr_stats_t;
+
+#define ZR_TRACE_ORIGIN(r) ((r)->info & 0xF)
+#define ZR_TRACE_SIZE(r) ((r)->info >> 4)
+
+typedef struct {
+    zr_u32_t offset;            // from fs->start
+    zr_u32_t info;              // size << 4 | origin, sizes are cut at 2^28 - 1
+} zr_trace_rec_t;
+
+typedef struct {
+    zr_trace_rec_t* recs;       // ring in caller RAM
+    zr_u32_t n;                 // records in recs
+    zr_u32_t head;              // records written so far, the next one goes to recs[head % n]
+    zr_u32_t tail;              // records taken out by zr_trace_copy(), older ones than head - n are lost
+} zr_trace_t;
+
+typedef struct zr_fs {
     zr_u32_t start;
     void (*read_f)(zr_u32_t offset, void* buf, zr_u32_t size);
+    void (*read_fv)(struct zr_fs* fs, const zr_iovec_t* iov, int iovcnt);    // optional scatter read
+    void (*read_async_f)(struct zr_fs* fs, zr_u32_t offset, void* buf,
+        zr_u32_t size, zr_done_f done, void* ctx);    // optional, must call done(ctx, size) when finished
+    void (*poll_f)(struct zr_fs* fs, int wait);    // optional, submits queued async reads, with wait blocks until one is done, zr_stream() needs it to overlap
+    void* user;                 // backend context for read_fv/read_async_f
+    const void* base;           // memory-mapped volume: offset 0 of read_f, replaces read_f
+    zr_u32_t io_align;          // optional backend page, power of 2: whole pages go straight to the caller's buffer
+    zr_u32_t io_burst;          // largest transfer, multiple of io_align, 0 = no limit
+    void* io_bounce;            // io_align bytes for partial pages, NULL = read them unaligned
+    zr_u32_t io_page;           // page held in io_bounce + 1, 0 = none
     zr_u32_t size;
+    void* cache_buf;            // optional block cache RAM, 4-byte aligned
+    zr_u32_t cache_size;        // bytes in cache_buf, 0 = no cache
+    zr_u32_t cache_hits, cache_misses;
+    void* index_buf;            // optional path index built at mount, 4-byte aligned
+    zr_u32_t index_size;        // bytes in index_buf, 0 = no index
+    void* bloom_buf;            // optional Bloom filter of all paths built at mount, 4-byte aligned
+    zr_u32_t bloom_size;        // bytes in bloom_buf, 0 = none
+    zr_u32_t img_index;         // slots of the on-image .zrindex, found at mount, 0 = none
+    zr_u32_t img_index_n;
+    const zr_u32_t* verify_sums;    // optional CRC-32 per image region, see tools/zr_mksums
+    zr_u32_t* verify_map;       // 1 bit per region, set once verified, or once failed unless strict without verify_bad
+    zr_u32_t* verify_bad;       // optional, 1 bit per region like verify_map, set for the ones that failed
+    zr_u32_t verify_failed;     // regions that failed verification, cleared at mount
+    zr_u8_t verify_shift;       // region size is 1 << verify_shift bytes
+    zr_u8_t verify_flags;       // ZR_VERIFY_xxx
+    zr_u32_t verify_next;       // next region for zr_verify_step()
+    zr_stats_t* stats;          // optional backend I/O counters, cleared at mount, not locked
+    zr_trace_t* trace;          // optional record of every backend request, cleared at mount, not locked
 } zr_fs_t;
 
 typedef struct {
+    zr_fs_t* fs;
     zr_u32_t offset;
+    zr_u32_t steps;             // entries read, more than fit in the image is a cycle
 } zr_dir_t;
 
+enum {
+    ZR_ADV_NORMAL,              // read-ahead once reads look sequential
+    ZR_ADV_SEQUENTIAL,          // always read ahead a full window
+    ZR_ADV_RANDOM,              // never read ahead
+    ZR_ADV_WILLNEED             // prefetch a window at the current position now
+};
+
+typedef struct {
+    zr_fs_t* fs;                // NULL when closed
+    zr_u32_t size, curr_pos, offset;
+#if ZR_READAHEAD_SIZE > 0
+    zr_u32_t ra_pos, ra_len;    // file range held in ra_buf
+    zr_u16_t ra_win;
+    zr_u8_t advice, seq;
+    zr_u8_t ra_buf[ZR_READAHEAD_SIZE];
+#endif
+#if ZR_LZ4_BLOCK_SIZE > 0
+    zr_u32_t z_table;           // block table of a compressed file, 0 = plain file
+    zr_u32_t z_block;           // block decoded in z_buf, ~0 = none
+    zr_u32_t z_tab0;            // first block of the cached table entries
+    zr_u32_t z_tab[9];
+    zr_u8_t z_shift;            // log2 of the block size
+    zr_u8_t z_buf[ZR_LZ4_BLOCK_SIZE + ZR_LZ4_MARGIN];
+#endif
+} zr_file_t;
+
+enum {
+    ZR_READDIR_SKIP_DOTS = 1    // zr_readdir_batch() leaves out . and ..
+};
+
+// volumes stacked for zr_overlay_xxx(), every path resolves on the first
+// one that has it, zr_overlay_opendir() lists that volume's directory only
+typedef struct {
+    zr_fs_t* const* layers;     // mounted with zr_fs_mount() or zr_mount(), top first
+    int n;
+} zr_overlay_t;
+
+// fd pool slot, fds are (generation << ZR_FD_INDEX_BITS) | (slot + 3), a
+// closed fd stops working when its slot is reused
+typedef struct {
+    zr_file_t file;
+    zr_u16_t gen;
+    zr_u16_t next;              // free list link
+} zr_fd_slot_t;
+#define ZR_FD_POOL_BYTES(n) ((n) * sizeof(zr_fd_slot_t))    // RAM for n open files
+#define ZR_FD_INDEX_BITS (sizeof(int) > 2 ? 16 : 8)
+
+enum {
+    ZR_FSCK_DATA = 1,           // CRC-32 every file's contents into data_sum
+    ZR_FSCK_SHALLOW = 2         // check the entries of the directory only, not the ones below
+};
+
+enum {
+    ZR_FSCK_OK,
+    ZR_FSCK_BOUNDS,             // header, name, data or link target outside the image, or unaligned
+    ZR_FSCK_CHECKSUM,           // header and name don't sum to 0, or the superblock doesn't
+    ZR_FSCK_CYCLE,              // header reached twice, list longer than the image, or deeper than ZR_MAX_DEPTH
+    ZR_FSCK_TYPE                // hard link to a hard link, . or .. not to a directory, directory without a list
+};
+
+typedef struct {
+    zr_u32_t* map;              // optional visited set, ZR_FSCK_MAP_BYTES(image size), NULL = find cycles by counting only
+    zr_u32_t map_size;
+    zr_u32_t headers, dirs, files;    // checked so far, files reached through hard links too
+    zr_u32_t bytes;             // file data in them
+    zr_u32_t data_sum;          // ZR_FSCK_DATA: sum of the files' CRC-32, so subtrees add up
+    zr_u32_t errors;
+    zr_u32_t bad;               // header of the first error
+    int error;                  // ZR_FSCK_xxx of the first error
+} zr_fsck_t;
+#define ZR_FSCK_MAP_BYTES(size) (((size) / 16 + 31) / 32 * 4)    // 1 bit per 16 bytes of image
+
 typedef struct {
     char fname[16];
     zr_u32_t fsize;
@@ -64,14 +245,65 @@ typedef struct {
 
 int zr_mount(zr_fs_t* fs);                                  // mount a volume
 ZR_RESULT zr_select_volume(int volume_id);                  // select current volume
+int zr_get_volume(void);                                    // id of the current volume
+zr_fs_t* zr_get_fs(int volume_id);                          // what a volume was mounted with, NULL if not mounted
+ZR_RESULT zr_set_fd_pool(void* buf, zr_u32_t size);        // fd slots in caller RAM, NULL = built-in, no file may be open
 int zr_open(const char* path);                              // open a file
 ZR_RESULT zr_close(int fd);                                 // close a opened file
 int zr_read(int fd, void* buff, zr_u32_t nbytes);           // read data from a file
+ZR_RESULT zr_read_ptr(int fd, const void** ptr, zr_u32_t* len);    // zero-copy read from a mapped volume
+int zr_read_async(int fd, void* buff, zr_u32_t nbytes, zr_done_f on_done,
+    void* ctx);                                             // queue a read, on_done(ctx, n) when data is in buff
+int zr_stream(int fd, zr_u32_t length, zr_sink_f sink, void* ctx,
+    zr_u32_t chunk_hint);                                   // feed up to length bytes to sink, returns bytes streamed
 ZR_RESULT zr_lseek(int fd, zr_u32_t offset, int seek_opt);  // move current read position to offset
 zr_u32_t zr_tell(int fd);                                   // return current read position of fd
+ZR_RESULT zr_fadvise(int fd, int advice);                   // ZR_ADV_xxx access pattern hint
 ZR_RESULT zr_stat(const char* path, zr_finfo_t* finfo);     // get file status
 ZR_RESULT zr_opendir(zr_dir_t* dir, const char* path);      // open a directory
 ZR_RESULT zr_readdir(zr_dir_t* dir, zr_finfo_t* finfo);     // read a directory item
+int zr_readdir_batch(zr_dir_t* dir, zr_finfo_t* items, int max, char* names,
+    zr_u32_t names_size, int flags);                        // up to max items, 0 at the end, ZR_DISK_ERR on a damaged list, full names one after another in names
+int zr_verify_step(zr_fs_t* fs, zr_u32_t budget);           // verify about budget bytes, returns regions left
+ZR_RESULT zr_fsck(zr_fs_t* fs, const char* path, int flags,
+    zr_fsck_t* r);                                          // check the tree below path, ZR_DISK_ERR if anything is wrong
+zr_stats_t* zr_get_stats(int volume_id);                    // I/O counters of a volume, NULL if it has none
+ZR_RESULT zr_reset_stats(int volume_id);                    // clear the counters, keeps the clock
+zr_trace_t* zr_get_trace(int volume_id);                    // request trace of a volume, NULL if it has none
+zr_u32_t zr_trace_copy(zr_trace_t* tr, zr_trace_rec_t* out, zr_u32_t max);    // oldest records first, removes them from the ring
+
+// reentrant API: everything is reached through the arguments, no current volume
+ZR_RESULT zr_fs_mount(zr_fs_t* fs);                         // check and prepare a volume without registering it
+ZR_RESULT zr_fs_stat(zr_fs_t* fs, const char* path, zr_finfo_t* finfo);
+ZR_RESULT zr_fs_opendir(zr_fs_t* fs, zr_dir_t* dir, const char* path);
+ZR_RESULT zr_file_open(zr_fs_t* fs, zr_file_t* fp, const char* path);
+ZR_RESULT zr_file_close(zr_file_t* fp);
+int zr_file_read(zr_file_t* fp, void* buff, zr_u32_t nbytes);
+int zr_file_read_async(zr_file_t* fp, void* buff, zr_u32_t nbytes,
+    zr_done_f on_done, void* ctx);
+int zr_file_stream(zr_file_t* fp, zr_u32_t length, zr_sink_f sink, void* ctx,
+    zr_u32_t chunk_hint);
+ZR_RESULT zr_file_read_ptr(zr_file_t* fp, const void** ptr, zr_u32_t* len);
+ZR_RESULT zr_file_lseek(zr_file_t* fp, zr_u32_t offset, int seek_opt);
+zr_u32_t zr_file_tell(zr_file_t* fp);
+ZR_RESULT zr_file_advise(zr_file_t* fp, int advice);
+
+// overlay API: the first layer holding the path wins, a path missing from a
+// layer with a Bloom filter usually costs no read there
+ZR_RESULT zr_overlay_stat(const zr_overlay_t* ov, const char* path,
+    zr_finfo_t* finfo);
+ZR_RESULT zr_overlay_opendir(const zr_overlay_t* ov, zr_dir_t* dir,
+    const char* path);
+ZR_RESULT zr_overlay_open(const zr_overlay_t* ov, zr_file_t* fp,
+    const char* path);
+int zr_open_overlay(const zr_overlay_t* ov, const char* path);    // like zr_open, a fd
+
+#if ZR_REENTRANT
+// provided by the application; fs == NULL guards the fd and volume tables,
+// otherwise the block cache of that volume
+void zr_lock(zr_fs_t* fs);
+void zr_unlock(zr_fs_t* fs);
+#endif
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,252 @@
+#ifndef __ZROMFS_HPP
+#define __ZROMFS_HPP
+
+// C++17 front end over the reentrant API. The backend is a template
+// argument, so a volume<mapped> serves file reads with inline loads from
+// the image and never goes through read_f. Handles close themselves,
+// nothing allocates: paths are copied to a stack buffer of max_path bytes
+// to get the NUL the C API wants. Errors are ZR_RESULT codes, no exceptions.
+//
+//   zr::volume<zr::mapped> vol(zr::mapped{image});
+//   if(vol.mount() == ZR_OK)
+//       for(const zr::entry& e : vol.opendir("/"))
+//           printf("%.*s\n", (int)e.name().size(), e.name().data());
+//
+// With C++20, read() also takes std::span and file::data() returns one.
+
+#include <string.h>
+#include <string_view>
+#if __cplusplus >= 202002L && __has_include(<span>)
+#include <span>
+#endif
+#include "zromfs.h"
+
+namespace zr {
+
+constexpr size_t max_path = 256;    // longer paths are not found
+
+// read policies
+
+struct mapped {                     // image in the address space, read_f unused
+    static constexpr bool is_mapped = true;
+    const void* base;
+    void bind(zr_fs_t& fs) const { fs.base = base; }
+};
+
+template<void (*Read)(zr_u32_t offset, void* buf, zr_u32_t size)>
+struct callback {                   // a driver function fixed at compile time
+    static constexpr bool is_mapped = false;
+    void bind(zr_fs_t& fs) const { fs.read_f = Read; }
+};
+
+template<class Policy, unsigned Sectors>
+struct cached : Policy {            // Policy plus a block cache held in the volume
+    static_assert(!Policy::is_mapped, "mapped volumes bypass the cache");
+    alignas(4) zr_u8_t cache[ZR_CACHE_BYTES(Sectors)];
+    cached(const Policy& p = Policy()) : Policy(p) {}
+    cached(const cached& o) : Policy(o) {}    // the cache itself isn't copied
+    void bind(zr_fs_t& fs)
+    {
+        Policy::bind(fs);
+        fs.cache_buf = cache;
+        fs.cache_size = sizeof(cache);
+    }
+};
+
+// NUL terminated copy of a path, empty when it doesn't fit
+class path_buf {
+public:
+    explicit path_buf(std::string_view path)
+    {
+        if(path.size() < max_path) {
+            memcpy(buf_, path.data(), path.size());
+            buf_[path.size()] = '\0';
+        }
+        ok_ = path.size() < max_path;
+    }
+    bool ok() const { return ok_; }
+    const char* c_str() const { return buf_; }
+
+private:
+    char buf_[max_path];
+    bool ok_;
+};
+
+struct entry : zr_finfo_t {
+    std::string_view name() const { return {fname, strnlen(fname, sizeof(fname))}; }
+    bool is_dir() const { return ftype == ZR_FTYPE_DIR; }
+    bool is_file() const { return ftype == ZR_FTYPE_REGULAR; }
+};
+
+template<class Policy>
+class file {
+public:
+    file() { f_.fs = nullptr; err_ = ZR_FILE_NOT_OPENED; }
+    file(zr_fs_t* fs, std::string_view path)
+    {
+        path_buf p(path);
+        f_.fs = nullptr;
+        err_ = p.ok() ? zr_file_open(fs, &f_, p.c_str()) : ZR_FILE_NOT_FOUND;
+        direct_ = Policy::is_mapped && f_.fs != nullptr
+            && fs->verify_sums == nullptr
+#if ZR_LZ4_BLOCK_SIZE > 0
+            && f_.z_table == 0
+#endif
+            ;
+    }
+    file(file&& o) noexcept : f_(o.f_), err_(o.err_), direct_(o.direct_)
+    {
+        o.f_.fs = nullptr;
+        o.direct_ = false;
+    }
+    file& operator=(file&& o) noexcept
+    {
+        if(this != &o) {
+            close();
+            f_ = o.f_;
+            err_ = o.err_;
+            direct_ = o.direct_;
+            o.f_.fs = nullptr;
+            o.direct_ = false;
+        }
+        return *this;
+    }
+    file(const file&) = delete;
+    file& operator=(const file&) = delete;
+    ~file() { close(); }
+
+    explicit operator bool() const { return f_.fs != nullptr; }
+    ZR_RESULT error() const { return err_; }
+    zr_u32_t size() const { return f_.size; }
+    zr_u32_t tell() const { return f_.curr_pos; }
+    ZR_RESULT seek(zr_u32_t offset) { return zr_file_lseek(&f_, offset, 0); }
+    ZR_RESULT advise(int advice) { return zr_file_advise(&f_, advice); }
+    zr_file_t* native() { return &f_; }
+
+    void close()
+    {
+        if(f_.fs != nullptr)
+            zr_file_close(&f_);
+        direct_ = false;
+    }
+
+    // bytes read or a negative ZR_RESULT, like zr_file_read()
+    int read(void* buf, zr_u32_t n)
+    {
+        if constexpr(Policy::is_mapped) {
+            if(direct_) {
+                zr_u32_t left = f_.size - f_.curr_pos;
+                if(n > left)
+                    n = left;
+                memcpy(buf, image() + f_.curr_pos, n);
+                f_.curr_pos += n;
+                return n;
+            }
+        }
+        return zr_file_read(&f_, buf, n);
+    }
+
+    // the whole file in place, empty if the bytes can't be handed out
+    // unchecked (not mapped, verified on read or compressed)
+    std::string_view view() const
+    {
+        if constexpr(Policy::is_mapped) {
+            if(direct_)
+                return {reinterpret_cast<const char*>(image()), f_.size};
+        }
+        return {};
+    }
+
+#ifdef __cpp_lib_span
+    int read(std::span<std::byte> buf) { return read(buf.data(), buf.size()); }
+    std::span<const std::byte> data() const
+    {
+        std::string_view v = view();
+        return {reinterpret_cast<const std::byte*>(v.data()), v.size()};
+    }
+#endif
+
+private:
+    const zr_u8_t* image() const    // first byte of the file
+    {
+        return static_cast<const zr_u8_t*>(f_.fs->base) + f_.offset;
+    }
+
+    zr_file_t f_;
+    ZR_RESULT err_ = ZR_OK;
+    bool direct_ = false;       // mapped, unverified and plain: read inline
+};
+
+class dir {
+public:
+    class iterator {
+    public:
+        iterator(dir* d = nullptr) : d_(d) {}
+        const entry& operator*() const { return d_->ent_; }
+        const entry* operator->() const { return &d_->ent_; }
+        iterator& operator++()
+        {
+            if(!d_->next())
+                d_ = nullptr;
+            return *this;
+        }
+        bool operator==(const iterator& o) const { return d_ == o.d_; }
+        bool operator!=(const iterator& o) const { return d_ != o.d_; }
+
+    private:
+        dir* d_;
+    };
+
+    dir(zr_fs_t* fs, std::string_view path)
+    {
+        path_buf p(path);
+        err_ = p.ok() ? zr_fs_opendir(fs, &d_, p.c_str()) : ZR_DIR_NOT_FOUND;
+    }
+
+    explicit operator bool() const { return err_ == ZR_OK; }
+    ZR_RESULT error() const { return err_; }
+
+    // single pass, "." and ".." included like zr_readdir()
+    iterator begin() { return *this && next() ? iterator(this) : end(); }
+    iterator end() { return iterator(); }
+
+private:
+    bool next() { return zr_readdir(&d_, &ent_) == ZR_OK; }
+
+    zr_dir_t d_;
+    entry ent_;
+    ZR_RESULT err_;
+};
+
+template<class Policy>
+class volume {
+public:
+    explicit volume(const Policy& p = Policy()) : policy_(p) {}
+    volume(const volume&) = delete;    // files and dirs point at fs_
+    volume& operator=(const volume&) = delete;
+
+    // set up index_buf, stats etc. through native() before mounting
+    ZR_RESULT mount()
+    {
+        policy_.bind(fs_);
+        return zr_fs_mount(&fs_);
+    }
+
+    file<Policy> open(std::string_view path) { return file<Policy>(&fs_, path); }
+    dir opendir(std::string_view path) { return dir(&fs_, path); }
+    ZR_RESULT stat(std::string_view path, entry& e)
+    {
+        path_buf p(path);
+        return p.ok() ? zr_fs_stat(&fs_, p.c_str(), &e) : ZR_FILE_NOT_FOUND;
+    }
+
+    zr_fs_t& native() { return fs_; }
+
+private:
+    Policy policy_;
+    zr_fs_t fs_ = zr_fs_t();
+};
+
+}    // namespace zr
+
+#endif